@@ -0,0 +1,119 @@
+#include "BrickPyramid.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace mc {
+
+    BrickPyramid::Range& BrickPyramid::Level::at(int x, int y, int z) {
+        return ranges[((size_t)z * ny + y) * nx + x];
+    }
+
+    const BrickPyramid::Range& BrickPyramid::Level::at(int x, int y, int z) const {
+        return ranges[((size_t)z * ny + y) * nx + x];
+    }
+
+    BrickPyramid::BrickPyramid() :
+        row_words(0)
+    {
+    }
+
+    void BrickPyramid::resize(int nx, int ny, int nz) {
+        levels.resize(1);
+        Level& base = levels[0];
+        base.nx = (nx - 1 + BRICK_SIZE - 1) / BRICK_SIZE;
+        base.ny = (ny - 1 + BRICK_SIZE - 1) / BRICK_SIZE;
+        base.nz = (nz - 1 + BRICK_SIZE - 1) / BRICK_SIZE;
+        base.ranges.resize((size_t)base.nx * base.ny * base.nz);
+        row_words = (base.nx + 63) / 64;
+    }
+
+    int BrickPyramid::bricksX() const {
+        return levels[0].nx;
+    }
+
+    int BrickPyramid::bricksY() const {
+        return levels[0].ny;
+    }
+
+    int BrickPyramid::bricksZ() const {
+        return levels[0].nz;
+    }
+
+    BrickPyramid::Range& BrickPyramid::brick(int bx, int by, int bz) {
+        return levels[0].at(bx, by, bz);
+    }
+
+    const BrickPyramid::Range& BrickPyramid::brick(int bx, int by, int bz) const {
+        return levels[0].at(bx, by, bz);
+    }
+
+    int BrickPyramid::rowWords() const {
+        return row_words;
+    }
+
+    void BrickPyramid::buildLevels() {
+        levels.resize(1);
+        while (levels.back().nx > 1 || levels.back().ny > 1 || levels.back().nz > 1) {
+            const Level& fine = levels.back();
+            Level coarse;
+            coarse.nx = (fine.nx + 1) / 2;
+            coarse.ny = (fine.ny + 1) / 2;
+            coarse.nz = (fine.nz + 1) / 2;
+            coarse.ranges.resize((size_t)coarse.nx * coarse.ny * coarse.nz);
+
+            for (int z = 0; z < coarse.nz; z++) {
+                for (int y = 0; y < coarse.ny; y++) {
+                    for (int x = 0; x < coarse.nx; x++) {
+                        Range range = fine.at(2 * x, 2 * y, 2 * z);
+                        for (int dz = 0; dz < 2 && 2 * z + dz < fine.nz; dz++) {
+                            for (int dy = 0; dy < 2 && 2 * y + dy < fine.ny; dy++) {
+                                for (int dx = 0; dx < 2 && 2 * x + dx < fine.nx; dx++) {
+                                    const Range& child = fine.at(2 * x + dx, 2 * y + dy, 2 * z + dz);
+                                    range.min = min(range.min, child.min);
+                                    range.max = max(range.max, child.max);
+                                }
+                            }
+                        }
+                        coarse.at(x, y, z) = range;
+                    }
+                }
+            }
+            levels.push_back(coarse);
+        }
+    }
+
+    void BrickPyramid::descend(int level, int x, int y, int z, float lo, float hi, vector<uint64_t>& rows) const {
+        const Level& node_level = levels[level];
+        if (x >= node_level.nx || y >= node_level.ny || z >= node_level.nz) {
+            return;
+        }
+        if (!overlaps(node_level.at(x, y, z), lo, hi)) {
+            return;
+        }
+
+        if (level == 0) {
+            rows[((size_t)z * node_level.ny + y) * row_words + x / 64] |= (uint64_t)1 << (x % 64);
+            return;
+        }
+
+        for (int dz = 0; dz < 2; dz++) {
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    descend(level - 1, 2 * x + dx, 2 * y + dy, 2 * z + dz, lo, hi, rows);
+                }
+            }
+        }
+    }
+
+    void BrickPyramid::findActive(float isovalue, vector<uint64_t>& rows) const {
+        findOverlapping(isovalue, isovalue, rows);
+    }
+
+    void BrickPyramid::findOverlapping(float lo, float hi, vector<uint64_t>& rows) const {
+        const Level& base = levels[0];
+        rows.assign((size_t)row_words * base.ny * base.nz, 0);
+        descend((int)levels.size() - 1, 0, 0, 0, lo, hi, rows);
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#ifndef _BrickPyramid_H_
+#define _BrickPyramid_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace mc {
+
+    // Cells along each edge of a brick
+    const int BRICK_SIZE = 8;
+
+    // Value range of every BRICK_SIZE^3 block of cells (level 0), plus coarser levels that
+    // each merge 2x2x2 nodes of the level below. A brick's range covers all of its corner
+    // samples, so the isosurface can only cross cells of bricks whose range straddles it.
+    class BrickPyramid {
+    public:
+        struct Range {
+            float min;
+            float max;
+        };
+
+        BrickPyramid();
+
+        // Sizes level 0 for a grid of nx * ny * nz samples and drops the coarser levels
+        void resize(int nx, int ny, int nz);
+
+        int bricksX() const;
+        int bricksY() const;
+        int bricksZ() const;
+
+        // Level 0 range, to be filled in before buildLevels
+        Range& brick(int bx, int by, int bz);
+        const Range& brick(int bx, int by, int bz) const;
+
+        // Builds the coarser levels from level 0
+        void buildLevels();
+
+        // Words per row of bricks in the masks written by findActive
+        int rowWords() const;
+
+        // Sets bit bx % 64 of word bx / 64 of row (by, bz) in rows for every brick whose
+        // range straddles isovalue, descending only into straddling nodes
+        void findActive(float isovalue, std::vector<uint64_t>& rows) const;
+        // Same for every brick that may hold a sample in [lo, hi), which are the only
+        // bricks where samples change sides when the isovalue moves between lo and hi
+        void findOverlapping(float lo, float hi, std::vector<uint64_t>& rows) const;
+
+    private:
+        struct Level {
+            int nx, ny, nz;
+            std::vector<Range> ranges;
+
+            Range& at(int x, int y, int z);
+            const Range& at(int x, int y, int z) const;
+        };
+
+        std::vector<Level> levels;
+        int row_words;
+
+        void descend(int level, int x, int y, int z, float lo, float hi, std::vector<uint64_t>& rows) const;
+    };
+
+    // A range overlaps [lo, hi] when it has a value below hi and one at or above lo
+    inline bool overlaps(const BrickPyramid::Range& range, float lo, float hi) {
+        return range.min < hi && range.max >= lo;
+    }
+
+    // A brick range straddles isovalue when it has corners on both sides of it
+    inline bool straddles(const BrickPyramid::Range& range, float isovalue) {
+        return overlaps(range, isovalue, isovalue);
+    }
+}
+
+#endif /* _BrickPyramid_H_ */
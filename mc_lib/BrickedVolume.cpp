@@ -0,0 +1,529 @@
+#include "BrickedVolume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#define BRICKED_MAGIC "MCBV"
+#define BRICKED_VERSION 1
+// Bytes of the header and of one index entry
+#define HEADER_BYTES 52
+#define ENTRY_BYTES 24
+// Longest run or literal stretch in one run-length code
+#define MAX_RUN 128
+
+using namespace glm;
+using namespace std;
+
+namespace mc {
+
+    static void put_u32(vector<uint8_t>& out, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            out.push_back((uint8_t)(v >> (8 * i)));
+        }
+    }
+
+    static void put_u64(vector<uint8_t>& out, uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+            out.push_back((uint8_t)(v >> (8 * i)));
+        }
+    }
+
+    static void put_f32(vector<uint8_t>& out, float v) {
+        uint32_t bits;
+        memcpy(&bits, &v, 4);
+        put_u32(out, bits);
+    }
+
+    static uint32_t get_u32(const uint8_t* p) {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static uint64_t get_u64(const uint8_t* p) {
+        return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+    }
+
+    static float get_f32(const uint8_t* p) {
+        uint32_t bits = get_u32(p);
+        float v;
+        memcpy(&v, &bits, 4);
+        return v;
+    }
+
+    // Bit pattern of v stored as type, integer types rounded and clamped
+    static uint32_t to_bits(VoxelType type, float v) {
+        switch (type) {
+        case VOXEL_UINT8:
+            return (uint32_t)min(max(floor(v + .5f), 0.0f), 255.0f);
+        case VOXEL_UINT16:
+            return (uint32_t)min(max(floor(v + .5f), 0.0f), 65535.0f);
+        case VOXEL_INT16:
+            return (uint16_t)(int16_t)min(max(floor(v + .5f), -32768.0f), 32767.0f);
+        case VOXEL_INT8:
+            return (uint8_t)(int8_t)min(max(floor(v + .5f), -128.0f), 127.0f);
+        case VOXEL_FLOAT32: {
+            uint32_t bits;
+            memcpy(&bits, &v, 4);
+            return bits;
+        }
+        }
+        throw invalid_argument("Unknown voxel type");
+    }
+
+    static float from_bits(VoxelType type, uint32_t bits) {
+        switch (type) {
+        case VOXEL_UINT8:
+        case VOXEL_UINT16:
+            return (float)bits;
+        case VOXEL_INT16:
+            return (float)(int16_t)(uint16_t)bits;
+        case VOXEL_INT8:
+            return (float)(int8_t)(uint8_t)bits;
+        case VOXEL_FLOAT32: {
+            float v;
+            memcpy(&v, &bits, 4);
+            return v;
+        }
+        }
+        throw invalid_argument("Unknown voxel type");
+    }
+
+    // PackBits: a code c in [0, 127] is followed by c + 1 literal bytes, a code in
+    // [-127, -1] by one byte repeated 1 - c times
+    static void pack_runs(const vector<uint8_t>& in, vector<uint8_t>& out) {
+        size_t i = 0;
+        while (i < in.size()) {
+            size_t run = 1;
+            while (i + run < in.size() && run < MAX_RUN && in[i + run] == in[i]) {
+                run++;
+            }
+            if (run >= 3) {
+                out.push_back((uint8_t)(int8_t)(1 - (int)run));
+                out.push_back(in[i]);
+                i += run;
+                continue;
+            }
+
+            // Literals up to the next run of three
+            size_t end = i;
+            while (end < in.size() && end - i < MAX_RUN &&
+                !(end + 2 < in.size() && in[end] == in[end + 1] && in[end] == in[end + 2])) {
+                end++;
+            }
+            out.push_back((uint8_t)(end - i - 1));
+            out.insert(out.end(), in.begin() + i, in.begin() + end);
+            i = end;
+        }
+    }
+
+    static void unpack_runs(const vector<uint8_t>& in, vector<uint8_t>& out) {
+        size_t i = 0;
+        while (i < in.size()) {
+            int code = (int8_t)in[i++];
+            if (code >= 0) {
+                if (i + code + 1 > in.size()) {
+                    throw runtime_error("Corrupt brick in bricked volume");
+                }
+                out.insert(out.end(), in.begin() + i, in.begin() + i + code + 1);
+                i += code + 1;
+            }
+            else if (code != -128) {
+                if (i >= in.size()) {
+                    throw runtime_error("Corrupt brick in bricked volume");
+                }
+                out.insert(out.end(), (size_t)(1 - code), in[i++]);
+            }
+        }
+    }
+
+    // Stores each voxel's difference from the previous one, XOR for floats, which keeps
+    // the high bytes of smooth fields at zero. Byte k of every difference goes to plane k
+    // so those zeros form long runs, then the planes are run-length coded.
+    static void encode_brick(const vector<float>& values, VoxelType type, vector<uint8_t>& out) {
+        int size = voxel_bytes(type);
+        uint32_t mask = size == 4 ? 0xffffffffu : (1u << (8 * size)) - 1;
+        size_t count = values.size();
+        vector<uint8_t> planes(count * size);
+
+        uint32_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t bits = to_bits(type, values[i]);
+            uint32_t delta = type == VOXEL_FLOAT32 ? bits ^ previous : (bits - previous) & mask;
+            previous = bits;
+            for (int k = 0; k < size; k++) {
+                planes[k * count + i] = (uint8_t)(delta >> (8 * k));
+            }
+        }
+        pack_runs(planes, out);
+    }
+
+    static void decode_brick(const vector<uint8_t>& in, VoxelType type, vector<float>& values) {
+        int size = voxel_bytes(type);
+        uint32_t mask = size == 4 ? 0xffffffffu : (1u << (8 * size)) - 1;
+        size_t count = values.size();
+        vector<uint8_t> planes;
+        planes.reserve(count * size);
+        unpack_runs(in, planes);
+        if (planes.size() != count * size) {
+            throw runtime_error("Corrupt brick in bricked volume");
+        }
+
+        uint32_t previous = 0;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t delta = 0;
+            for (int k = 0; k < size; k++) {
+                delta |= (uint32_t)planes[k * count + i] << (8 * k);
+            }
+            uint32_t bits = type == VOXEL_FLOAT32 ? delta ^ previous : (delta + previous) & mask;
+            previous = bits;
+            values[i] = from_bits(type, bits);
+        }
+    }
+
+    static Grid read_grid(const string& path) {
+        ifstream in(path.c_str(), ios::binary);
+        uint8_t header[HEADER_BYTES];
+        if (!in.read((char*)header, HEADER_BYTES)) {
+            throw runtime_error("Cannot read bricked volume " + path);
+        }
+        if (memcmp(header, BRICKED_MAGIC, 4) != 0 || get_u32(header + 4) != BRICKED_VERSION) {
+            throw runtime_error(path + " is not a bricked volume");
+        }
+        return Grid((int)get_u32(header + 8), (int)get_u32(header + 12), (int)get_u32(header + 16),
+            vec3(get_f32(header + 20), get_f32(header + 24), get_f32(header + 28)),
+            vec3(get_f32(header + 32), get_f32(header + 36), get_f32(header + 40)));
+    }
+
+    static int brick_count(int samples, int brick_size) {
+        return (samples - 2) / brick_size + 1;
+    }
+
+    BrickedVolume::BrickedVolume(const string& path) :
+        VoxelField(read_grid(path)),
+        file(path.c_str(), ios::binary),
+        loaded(0)
+    {
+        uint8_t header[HEADER_BYTES];
+        if (!file.read((char*)header, HEADER_BYTES)) {
+            throw runtime_error("Cannot read bricked volume " + path);
+        }
+        type = (VoxelType)get_u32(header + 44);
+        brick_size = (int)get_u32(header + 48);
+        if (type > VOXEL_INT8 || brick_size < 1) {
+            throw runtime_error(path + " is not a bricked volume");
+        }
+
+        bricks_x = brick_count(volume.nx, brick_size);
+        bricks_y = brick_count(volume.ny, brick_size);
+        bricks_z = brick_count(volume.nz, brick_size);
+        size_t bricks = (size_t)bricks_x * bricks_y * bricks_z;
+
+        vector<uint8_t> entries(bricks * ENTRY_BYTES);
+        if (!file.read((char*)entries.data(), entries.size())) {
+            throw runtime_error("Cannot read the index of bricked volume " + path);
+        }
+        index.resize(bricks);
+        for (size_t b = 0; b < bricks; b++) {
+            const uint8_t* p = &entries[b * ENTRY_BYTES];
+            index[b].offset = get_u64(p);
+            index[b].bytes = get_u64(p + 8);
+            index[b].min = get_f32(p + 16);
+            index[b].max = get_f32(p + 20);
+        }
+
+        // A sweep along z uses one layer of bricks and reaches into the next
+        cache_capacity = 2 * (size_t)bricks_x * bricks_y;
+    }
+
+    int BrickedVolume::brickOf(int i, int bricks) const {
+        return min(i / brick_size, bricks - 1);
+    }
+
+    int BrickedVolume::bricksStoring(int i, int bricks, int* b) const {
+        b[0] = brickOf(i, bricks);
+        if (i > 0 && i == b[0] * brick_size) {
+            b[1] = b[0] - 1;
+            return 2;
+        }
+        return 1;
+    }
+
+    int BrickedVolume::brickSamples(int b, int n) const {
+        return min(brick_size, n - 1 - b * brick_size) + 1;
+    }
+
+    size_t BrickedVolume::brickIndex(int bx, int by, int bz) const {
+        return ((size_t)bz * bricks_y + by) * bricks_x + bx;
+    }
+
+    shared_ptr<const vector<float> > BrickedVolume::brick(int bx, int by, int bz) const {
+        size_t b = brickIndex(bx, by, bz);
+        {
+            // A brick another thread is decompressing is shared rather than read twice
+            unique_lock<mutex> held(cache_lock);
+            while (decoding.count(b)) {
+                decoded.wait(held);
+            }
+            auto found = cache.find(b);
+            if (found != cache.end()) {
+                return found->second;
+            }
+            decoding.insert(b);
+        }
+
+        shared_ptr<vector<float> > values;
+        try {
+            vector<uint8_t> packed((size_t)index[b].bytes);
+            {
+                lock_guard<mutex> held(file_lock);
+                file.seekg((streamoff)index[b].offset);
+                if (!file.read((char*)packed.data(), packed.size())) {
+                    file.clear();
+                    throw runtime_error("Cannot read brick of bricked volume");
+                }
+            }
+            values = make_shared<vector<float> >(
+                (size_t)brickSamples(bx, volume.nx) * brickSamples(by, volume.ny) * brickSamples(bz, volume.nz));
+            decode_brick(packed, type, *values);
+        }
+        catch (...) {
+            lock_guard<mutex> held(cache_lock);
+            decoding.erase(b);
+            decoded.notify_all();
+            throw;
+        }
+        loaded++;
+
+        lock_guard<mutex> held(cache_lock);
+        cache[b] = values;
+        cache_order.push_back(b);
+        while (cache_order.size() > cache_capacity) {
+            cache.erase(cache_order.front());
+            cache_order.pop_front();
+        }
+        decoding.erase(b);
+        decoded.notify_all();
+        return values;
+    }
+
+    shared_ptr<const vector<float> > BrickedVolume::cachedBrick(const int* xs, int x_count, const int* ys, int y_count,
+            const int* zs, int z_count, int& bx, int& by, int& bz) const {
+        if (x_count > 1 || y_count > 1 || z_count > 1) {
+            lock_guard<mutex> held(cache_lock);
+            for (int k = 0; k < z_count; k++) {
+                for (int j = 0; j < y_count; j++) {
+                    for (int i = 0; i < x_count; i++) {
+                        auto found = cache.find(brickIndex(xs[i], ys[j], zs[k]));
+                        if (found != cache.end()) {
+                            bx = xs[i];
+                            by = ys[j];
+                            bz = zs[k];
+                            return found->second;
+                        }
+                    }
+                }
+            }
+        }
+        bx = xs[0];
+        by = ys[0];
+        bz = zs[0];
+        return brick(bx, by, bz);
+    }
+
+    size_t BrickedVolume::bricksLoaded() const {
+        return loaded;
+    }
+
+    float BrickedVolume::voxel(int x, int y, int z) const {
+        int xs[2], ys[2], zs[2];
+        int x_count = bricksStoring(x, bricks_x, xs);
+        int y_count = bricksStoring(y, bricks_y, ys);
+        int z_count = bricksStoring(z, bricks_z, zs);
+        int bx, by, bz;
+        shared_ptr<const vector<float> > values = cachedBrick(xs, x_count, ys, y_count, zs, z_count, bx, by, bz);
+        int sx = brickSamples(bx, volume.nx), sy = brickSamples(by, volume.ny);
+        return (*values)[((size_t)(z - bz * brick_size) * sy + (y - by * brick_size)) * sx + (x - bx * brick_size)];
+    }
+
+    void BrickedVolume::valueRow(float x, float y, float z, float dx, int count, float* values) const {
+        int xi, yi, zi;
+        if (!rowVoxels(x, y, z, dx, count, xi, yi, zi)) {
+            Field::valueRow(x, y, z, dx, count, values);
+            return;
+        }
+        voxelRow(xi, yi, zi, count, values);
+    }
+
+    // Each brick along the row gives its samples up to its far face, so the row only
+    // reaches the next brick for samples past that face
+    void BrickedVolume::voxelRow(int xi, int yi, int zi, int count, float* values) const {
+        int ys[2], zs[2];
+        int y_count = bricksStoring(yi, bricks_y, ys);
+        int z_count = bricksStoring(zi, bricks_z, zs);
+        int last = xi + count - 1;
+        int i = xi;
+        while (i <= last) {
+            int column = brickOf(i, bricks_x);
+            int end = min((column + 1) * brick_size, last);
+            int bx, by, bz;
+            shared_ptr<const vector<float> > brick_values = cachedBrick(&column, 1, ys, y_count, zs, z_count, bx, by, bz);
+            int sx = brickSamples(bx, volume.nx), sy = brickSamples(by, volume.ny);
+            const float* row = &(*brick_values)[((size_t)(zi - bz * brick_size) * sy + (yi - by * brick_size)) * sx];
+            copy(row + (i - bx * brick_size), row + (end + 1 - bx * brick_size), values + (i - xi));
+            i = end + 1;
+        }
+    }
+
+    // A stencil within the brick holding its centre, faces included, is read from that
+    // brick alone. Stencils reaching past it, around voxels on the brick's near faces,
+    // go through voxel.
+    vec3 BrickedVolume::latticeGradient(int x, int y, int z) const {
+        int c[3] = {x, y, z};
+        int n[3] = {volume.nx, volume.ny, volume.nz};
+        int bricks[3] = {bricks_x, bricks_y, bricks_z};
+        int b[3], lo[3], hi[3];
+        for (int a = 0; a < 3; a++) {
+            b[a] = brickOf(c[a], bricks[a]);
+            lo[a] = max(c[a] - 1, 0) - b[a] * brick_size;
+            hi[a] = min(c[a] + 1, n[a] - 1) - b[a] * brick_size;
+            if (lo[a] < 0 || hi[a] > brick_size) {
+                return VoxelField::latticeGradient(x, y, z);
+            }
+        }
+
+        shared_ptr<const vector<float> > brick_values = brick(b[0], b[1], b[2]);
+        const vector<float>& v = *brick_values;
+        size_t sx = brickSamples(b[0], volume.nx), sy = brickSamples(b[1], volume.ny);
+        size_t centre = ((size_t)(z - b[2] * brick_size) * sy + (y - b[1] * brick_size)) * sx + (x - b[0] * brick_size);
+        size_t cx = centre - (x - b[0] * brick_size);
+        size_t cy = centre - (size_t)(y - b[1] * brick_size) * sx;
+        size_t cz = centre - (size_t)(z - b[2] * brick_size) * sx * sy;
+        return vec3(v[cx + hi[0]] - v[cx + lo[0]], v[cy + hi[1] * sx] - v[cy + lo[1] * sx],
+            v[cz + hi[2] * sx * sy] - v[cz + lo[2] * sx * sy]) * (.5f / volume.spacing);
+    }
+
+    // Cells [begin, end) of an axis belong to bricks brickOf(begin) to brickOf(end - 1),
+    // whose ranges cover the samples of the box with its far faces
+    bool BrickedVolume::bounds(vec3 lo, vec3 hi, float& min, float& max) const {
+        int begin[3], end[3];
+        boxVoxels(lo, hi, begin, end);
+        int bricks[3] = {bricks_x, bricks_y, bricks_z};
+        int first[3], past[3];
+        for (int a = 0; a < 3; a++) {
+            first[a] = brickOf(begin[a], bricks[a]);
+            past[a] = brickOf(std::max(end[a] - 1, begin[a]), bricks[a]) + 1;
+        }
+
+        min = INFINITY;
+        max = -INFINITY;
+        for (int bz = first[2]; bz < past[2]; bz++) {
+            for (int by = first[1]; by < past[1]; by++) {
+                for (int bx = first[0]; bx < past[0]; bx++) {
+                    const IndexEntry& entry = index[brickIndex(bx, by, bz)];
+                    min = std::min(min, entry.min);
+                    max = std::max(max, entry.max);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool BrickedVolume::boundsBlocks(vec3& origin, vec3& size) const {
+        origin = volume.origin;
+        size = volume.spacing * (float)brick_size;
+        return true;
+    }
+
+    void write_bricked_volume(const string& path, const Field& field, const Grid& grid, VoxelType type, int brick_size, ThreadPool* pool) {
+        if (grid.nx < 2 || grid.ny < 2 || grid.nz < 2) {
+            throw invalid_argument("Grid needs at least 2 samples along each axis");
+        }
+        if (brick_size < 1) {
+            throw invalid_argument("Brick size must be positive");
+        }
+        // Throws for an unknown type
+        voxel_bytes(type);
+
+        int bricks_x = brick_count(grid.nx, brick_size);
+        int bricks_y = brick_count(grid.ny, brick_size);
+        int bricks_z = brick_count(grid.nz, brick_size);
+        size_t bricks = (size_t)bricks_x * bricks_y * bricks_z;
+
+        vector<uint8_t> header;
+        header.insert(header.end(), BRICKED_MAGIC, BRICKED_MAGIC + 4);
+        put_u32(header, BRICKED_VERSION);
+        put_u32(header, (uint32_t)grid.nx);
+        put_u32(header, (uint32_t)grid.ny);
+        put_u32(header, (uint32_t)grid.nz);
+        for (int a = 0; a < 3; a++) {
+            put_f32(header, grid.origin[a]);
+        }
+        for (int a = 0; a < 3; a++) {
+            put_f32(header, grid.spacing[a]);
+        }
+        put_u32(header, (uint32_t)type);
+        put_u32(header, (uint32_t)brick_size);
+
+        ofstream out(path.c_str(), ios::binary);
+        // The index is written last, once the brick sizes are known
+        vector<uint8_t> entries;
+        entries.reserve(bricks * ENTRY_BYTES);
+        out.write((const char*)header.data(), header.size());
+        vector<char> placeholder(bricks * ENTRY_BYTES);
+        out.write(placeholder.data(), placeholder.size());
+        uint64_t offset = header.size() + placeholder.size();
+
+        // One layer of bricks at a time, sampled and compressed in parallel, written in order
+        int layer = bricks_x * bricks_y;
+        vector<vector<uint8_t> > packed(layer);
+        vector<BrickPyramid::Range> ranges(layer);
+        for (int bz = 0; bz < bricks_z && out; bz++) {
+            parallel_for(pool, layer, [&, bz](int i) {
+                int bx = i % bricks_x, by = i / bricks_x;
+                int x0 = bx * brick_size, y0 = by * brick_size, z0 = bz * brick_size;
+                int sx = min(brick_size, grid.nx - 1 - x0) + 1;
+                int sy = min(brick_size, grid.ny - 1 - y0) + 1;
+                int sz = min(brick_size, grid.nz - 1 - z0) + 1;
+
+                vector<float> values((size_t)sx * sy * sz);
+                for (int z = 0; z < sz; z++) {
+                    for (int y = 0; y < sy; y++) {
+                        vec3 p = grid.position(x0, y0 + y, z0 + z);
+                        field.valueRow(p.x, p.y, p.z, grid.spacing.x, sx, &values[((size_t)z * sy + y) * sx]);
+                    }
+                }
+
+                // Ranges of the values as stored, so they hold for the decoded brick
+                BrickPyramid::Range range;
+                range.min = INFINITY;
+                range.max = -INFINITY;
+                for (size_t v = 0; v < values.size(); v++) {
+                    values[v] = from_bits(type, to_bits(type, values[v]));
+                    range.min = min(range.min, values[v]);
+                    range.max = max(range.max, values[v]);
+                }
+                ranges[i] = range;
+
+                packed[i].clear();
+                encode_brick(values, type, packed[i]);
+            });
+
+            for (int i = 0; i < layer; i++) {
+                out.write((const char*)packed[i].data(), packed[i].size());
+                put_u64(entries, offset);
+                put_u64(entries, packed[i].size());
+                put_f32(entries, ranges[i].min);
+                put_f32(entries, ranges[i].max);
+                offset += packed[i].size();
+            }
+        }
+
+        out.seekp(header.size());
+        out.write((const char*)entries.data(), entries.size());
+        out.close();
+        if (!out) {
+            throw runtime_error("Cannot write bricked volume " + path);
+        }
+    }
+}
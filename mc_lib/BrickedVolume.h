@@ -0,0 +1,110 @@
+#pragma once
+#ifndef _BrickedVolume_H_
+#define _BrickedVolume_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.h"
+#include "VoxelField.h"
+
+namespace mc {
+
+    // Volume file split into bricks of brick_size^3 cells, each compressed on its own.
+    // A brick also stores the samples on its far faces, so it holds every corner of its
+    // cells, and the index gives the offset, size and value range of every brick.
+    //
+    // Layout, all little endian: "MCBV", version, nx, ny, nz, origin, spacing, voxel
+    // type and brick size, then per brick in z, y, x order its offset, compressed size,
+    // min and max, then the compressed bricks.
+    //
+    // Opening reads the header and index only. bounds answers from the index entries of
+    // the bricks owning the cells of the box, and a brick is read and decompressed the
+    // first time a sample needs it, then kept in a cache of about two layers of bricks.
+    // A sample on a face shared by bricks comes from one of them already in the cache
+    // when there is one, so reading a face does not load the brick on its other side.
+    // A StreamingExtractor over grid() queries and samples brick by brick, and only
+    // loads the bricks whose range straddles its isovalue, plus with GRADIENT_FUNCTION
+    // the neighbours its gradients reach into. Rows and gradient stencils look their
+    // bricks up once, not once per voxel, so threads sampling together rarely wait on
+    // the cache.
+    class BrickedVolume : public VoxelField {
+    public:
+        // Opens the file at path. Throws runtime_error if it cannot be read or is not a
+        // bricked volume.
+        explicit BrickedVolume(const std::string& path);
+
+        float voxel(int x, int y, int z) const;
+        void valueRow(float x, float y, float z, float dx, int count, float* values) const;
+        bool bounds(glm::vec3 lo, glm::vec3 hi, float& min, float& max) const;
+        bool boundsBlocks(glm::vec3& origin, glm::vec3& size) const;
+
+        // Bricks read and decompressed so far, including ones read again after eviction
+        size_t bricksLoaded() const;
+
+    protected:
+        void voxelRow(int x, int y, int z, int count, float* values) const;
+        glm::vec3 latticeGradient(int x, int y, int z) const;
+
+    private:
+        struct IndexEntry {
+            uint64_t offset;
+            uint64_t bytes;
+            float min, max;
+        };
+
+        VoxelType type;
+        int brick_size;
+        int bricks_x, bricks_y, bricks_z;
+        std::vector<IndexEntry> index;
+
+        mutable std::ifstream file;
+        mutable std::mutex file_lock;
+
+        // Decompressed bricks, evicted oldest first beyond cache_capacity
+        mutable std::map<size_t, std::shared_ptr<const std::vector<float> > > cache;
+        mutable std::deque<size_t> cache_order;
+        mutable std::mutex cache_lock;
+        size_t cache_capacity;
+        mutable std::atomic<size_t> loaded;
+        // Bricks being decompressed, other threads needing one wait for it
+        mutable std::set<size_t> decoding;
+        mutable std::condition_variable decoded;
+
+        BrickedVolume(const BrickedVolume&);
+        BrickedVolume& operator=(const BrickedVolume&);
+
+        // Brick holding sample i of an axis with bricks bricks along it, the one whose
+        // cells start at i for a sample on a face between bricks
+        int brickOf(int i, int bricks) const;
+        // Bricks storing sample i, brickOf(i) first, then the brick before it when i is on
+        // its far face. Returns how many.
+        int bricksStoring(int i, int bricks, int* b) const;
+        // Samples brick b stores along an axis of n samples
+        int brickSamples(int b, int n) const;
+        size_t brickIndex(int bx, int by, int bz) const;
+        std::shared_ptr<const std::vector<float> > brick(int bx, int by, int bz) const;
+        // Of the bricks xs x ys x zs, the first one found in the cache, else the first one,
+        // loaded. Sets bx, by and bz to the brick returned.
+        std::shared_ptr<const std::vector<float> > cachedBrick(const int* xs, int x_count, const int* ys, int y_count,
+            const int* zs, int z_count, int& bx, int& by, int& bz) const;
+    };
+
+    // Samples field over grid into a bricked volume file at path, storing voxels as type,
+    // integer types rounded and clamped to their range. Bricks of one layer are sampled
+    // and compressed in parallel on pool when one is given. Throws runtime_error if the
+    // file cannot be written.
+    void write_bricked_volume(const std::string& path, const Field& field, const Grid& grid, VoxelType type = VOXEL_FLOAT32,
+        int brick_size = 32, ThreadPool* pool = NULL);
+}
+
+#endif /* _BrickedVolume_H_ */
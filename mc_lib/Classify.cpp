@@ -0,0 +1,108 @@
+#include "Classify.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MC_SSE
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mc {
+
+    static int lowest_bit(uint64_t bits) {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long i;
+        _BitScanForward64(&i, bits);
+        return (int)i;
+#elif defined(_MSC_VER)
+        unsigned long i;
+        if (_BitScanForward(&i, (unsigned long)bits)) {
+            return (int)i;
+        }
+        _BitScanForward(&i, (unsigned long)(bits >> 32));
+        return (int)i + 32;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+    // Signs of samples x + 1 for the cells of word w, the next word is only read when
+    // the last cell of this one is needed
+    static uint64_t next_samples(const uint64_t* row, int w, bool last_cell) {
+        uint64_t next = last_cell ? row[w + 1] : 0;
+        return (row[w] >> 1) | (next << 63);
+    }
+
+    int sign_words(int samples) {
+        return (samples + 63) / 64;
+    }
+
+    uint64_t sign_word(const float* values, int count, float isovalue) {
+        uint64_t word = 0;
+        int i = 0;
+
+#ifdef MC_SSE
+        // Four compares per instruction, movemask gathers their sign bits
+        const __m128 iso = _mm_set1_ps(isovalue);
+        for (; i + 4 <= count; i += 4) {
+            __m128 below = _mm_cmplt_ps(_mm_loadu_ps(values + i), iso);
+            word |= (uint64_t)_mm_movemask_ps(below) << i;
+        }
+#endif
+        for (; i < count; i++) {
+            word |= (uint64_t)(values[i] < isovalue) << i;
+        }
+        return word;
+    }
+
+    uint64_t sign_word(const Half* values, int count, float isovalue) {
+        uint64_t word = 0;
+        for (int i = 0; i < count; i++) {
+            word |= (uint64_t)((float)values[i] < isovalue) << i;
+        }
+        return word;
+    }
+
+    int classify_cells(const uint64_t* y0z0, const uint64_t* y0z1, const uint64_t* y1z0, const uint64_t* y1z1,
+        int begin, int end, int* active, uint8_t* cubes) {
+        int count = 0;
+
+        for (int w = begin / 64; w * 64 < end; w++) {
+            // Cells of this word inside [begin, end)
+            uint64_t cells = ~(uint64_t)0;
+            if (w * 64 < begin) {
+                cells &= ~(uint64_t)0 << (begin - w * 64);
+            }
+            if (end - w * 64 < 64) {
+                cells &= ((uint64_t)1 << (end - w * 64)) - 1;
+            }
+            bool last_cell = (cells >> 63) != 0;
+
+            uint64_t a = y0z0[w], b = y0z1[w], c = y1z0[w], d = y1z1[w];
+            uint64_t a1 = next_samples(y0z0, w, last_cell);
+            uint64_t b1 = next_samples(y0z1, w, last_cell);
+            uint64_t c1 = next_samples(y1z0, w, last_cell);
+            uint64_t d1 = next_samples(y1z1, w, last_cell);
+
+            // A cell is crossed unless all eight corners agree with corner 0
+            uint64_t crossed = (a ^ b) | (a ^ c) | (a ^ d) | (a ^ a1) | (a ^ b1) | (a ^ c1) | (a ^ d1);
+            crossed &= cells;
+
+            while (crossed) {
+                int i = lowest_bit(crossed);
+                crossed &= crossed - 1;
+
+                // Corner bits follow the vertex numbering of get_voxel: 0 (x, y, z), 1 (x+1, y, z),
+                // 2 (x+1, y, z+1), 3 (x, y, z+1), 4 (x, y+1, z), 5 (x+1, y+1, z), 6 (x+1, y+1, z+1), 7 (x, y+1, z+1)
+                cubes[count] = (uint8_t)(
+                    ((a >> i) & 1) | ((a1 >> i) & 1) << 1 | ((b1 >> i) & 1) << 2 | ((b >> i) & 1) << 3 |
+                    ((c >> i) & 1) << 4 | ((c1 >> i) & 1) << 5 | ((d1 >> i) & 1) << 6 | ((d >> i) & 1) << 7);
+                active[count] = w * 64 + i;
+                count++;
+            }
+        }
+        return count;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#ifndef _Classify_H_
+#define _Classify_H_
+
+#include <cstdint>
+
+#include "Half.h"
+
+namespace mc {
+
+    // Number of 64-bit words holding the sign bits of a row of samples. Bit x % 64 of
+    // word x / 64 is set when sample x is below the isovalue, padding bits are clear.
+    int sign_words(int samples);
+
+    // Sign bits of up to 64 consecutive samples, bit i set when values[i] is below isovalue
+    uint64_t sign_word(const float* values, int count, float isovalue);
+    uint64_t sign_word(const Half* values, int count, float isovalue);
+
+    // Finds the cells [begin, end) of a row that the surface crosses, from the sign bits of
+    // the four sample rows around it: (y, z), (y, z + 1), (y + 1, z) and (y + 1, z + 1).
+    // Only the words holding samples [begin, end] are read. Works on 64 cells per word, so
+    // rows far from the surface cost a few operations per word. Positions of crossed cells
+    // go to active and their cube indices to cubes. Returns the number of crossed cells.
+    int classify_cells(const uint64_t* y0z0, const uint64_t* y0z1, const uint64_t* y1z0, const uint64_t* y1z1,
+        int begin, int end, int* active, uint8_t* cubes);
+}
+
+#endif /* _Classify_H_ */
@@ -0,0 +1,524 @@
+#include "Expression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+// Points evaluated per pass over the bytecode
+#define BATCH_LANES 64
+// Registers 0, 1 and 2 hold x, y and z, the rest are temporaries
+#define MAX_REGISTERS 64
+#define VARIABLES 3
+
+using namespace std;
+
+namespace mc {
+
+    enum Opcode {
+        OP_CONST,
+        OP_NEG,
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_POW,
+        OP_MIN,
+        OP_MAX,
+        OP_SIN,
+        OP_COS,
+        OP_TAN,
+        OP_SQRT,
+        OP_ABS,
+        OP_EXP,
+        OP_LOG,
+        OP_FLOOR
+    };
+
+    struct FunctionName {
+        const char* name;
+        int op;
+        int args;
+    };
+
+    static const FunctionName functions[] = {
+        {"sin", OP_SIN, 1},
+        {"cos", OP_COS, 1},
+        {"tan", OP_TAN, 1},
+        {"sqrt", OP_SQRT, 1},
+        {"abs", OP_ABS, 1},
+        {"exp", OP_EXP, 1},
+        {"log", OP_LOG, 1},
+        {"floor", OP_FLOOR, 1},
+        {"min", OP_MIN, 2},
+        {"max", OP_MAX, 2},
+        {"pow", OP_POW, 2}
+    };
+
+    // One lane of an operation, used for constant folding and for the operations
+    // without a vector version
+    static float apply(int op, float a, float b) {
+        switch (op) {
+        case OP_NEG:
+            return -a;
+        case OP_ADD:
+            return a + b;
+        case OP_SUB:
+            return a - b;
+        case OP_MUL:
+            return a * b;
+        case OP_DIV:
+            return a / b;
+        case OP_POW:
+            return pow(a, b);
+        case OP_MIN:
+            return simd::min(a, b);
+        case OP_MAX:
+            return simd::max(a, b);
+        case OP_SIN:
+            return sin(a);
+        case OP_COS:
+            return simd::cos(a);
+        case OP_TAN:
+            return tan(a);
+        case OP_SQRT:
+            return simd::sqrt(a);
+        case OP_ABS:
+            return simd::abs(a);
+        case OP_EXP:
+            return exp(a);
+        case OP_LOG:
+            return log(a);
+        case OP_FLOOR:
+            return floor(a);
+        }
+        throw logic_error("Unknown opcode");
+    }
+
+    // Recursive descent parser that emits bytecode as it goes. Each subexpression is
+    // either a folded constant or a register, temporaries are released once consumed.
+    class ExpressionCompiler {
+    public:
+        ExpressionCompiler(const string& source, ExpressionField& field) :
+            source(source),
+            pos(0),
+            field(field),
+            in_use(MAX_REGISTERS, false)
+        {
+        }
+
+        void compile() {
+            Operand value = expression();
+            skipSpace();
+            if (pos < source.size()) {
+                fail("Unexpected character");
+            }
+            field.result = registerOf(value);
+        }
+
+    private:
+        struct Operand {
+            bool constant;
+            float value;
+            int reg;
+        };
+
+        const string& source;
+        size_t pos;
+        ExpressionField& field;
+        vector<bool> in_use;
+
+        void fail(const char* message) {
+            throw invalid_argument(string(message) + " at position " + to_string(pos) + " in expression \"" + source + "\"");
+        }
+
+        void skipSpace() {
+            while (pos < source.size() && isspace((unsigned char)source[pos])) {
+                pos++;
+            }
+        }
+
+        bool accept(char c) {
+            skipSpace();
+            if (pos < source.size() && source[pos] == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c) {
+            if (!accept(c)) {
+                fail((string("Expected '") + c + "'").c_str());
+            }
+        }
+
+        static Operand constant(float value) {
+            Operand operand;
+            operand.constant = true;
+            operand.value = value;
+            operand.reg = -1;
+            return operand;
+        }
+
+        int allocate() {
+            for (int r = VARIABLES; r < MAX_REGISTERS; r++) {
+                if (!in_use[r]) {
+                    in_use[r] = true;
+                    return r;
+                }
+            }
+            fail("Expression needs too many registers");
+            return -1;
+        }
+
+        void release(const Operand& operand) {
+            if (!operand.constant && operand.reg >= VARIABLES) {
+                in_use[operand.reg] = false;
+            }
+        }
+
+        void emit(int op, int dst, int a, int b, float imm) {
+            ExpressionField::Instruction ins;
+            ins.op = (uint8_t)op;
+            ins.dst = (uint8_t)dst;
+            ins.a = (uint8_t)a;
+            ins.b = (uint8_t)b;
+            ins.imm = imm;
+            field.code.push_back(ins);
+        }
+
+        // Register holding the operand, loading constants into a new one
+        int registerOf(Operand& operand) {
+            if (operand.constant) {
+                operand.constant = false;
+                operand.reg = allocate();
+                emit(OP_CONST, operand.reg, 0, 0, operand.value);
+            }
+            return operand.reg;
+        }
+
+        Operand result() {
+            Operand operand;
+            operand.constant = false;
+            operand.value = 0;
+            operand.reg = allocate();
+            return operand;
+        }
+
+        Operand operation(int op, Operand a) {
+            if (a.constant) {
+                return constant(apply(op, a.value, 0));
+            }
+            int ra = registerOf(a);
+            release(a);
+
+            Operand dst = result();
+            emit(op, dst.reg, ra, ra, 0);
+            return dst;
+        }
+
+        Operand operation(int op, Operand a, Operand b) {
+            if (a.constant && b.constant) {
+                return constant(apply(op, a.value, b.value));
+            }
+            int ra = registerOf(a);
+            int rb = registerOf(b);
+            release(a);
+            release(b);
+
+            Operand dst = result();
+            emit(op, dst.reg, ra, rb, 0);
+            return dst;
+        }
+
+        Operand expression() {
+            Operand left = term();
+            while (true) {
+                if (accept('+')) {
+                    left = operation(OP_ADD, left, term());
+                }
+                else if (accept('-')) {
+                    left = operation(OP_SUB, left, term());
+                }
+                else {
+                    return left;
+                }
+            }
+        }
+
+        Operand term() {
+            Operand left = unary();
+            while (true) {
+                if (accept('*')) {
+                    left = operation(OP_MUL, left, unary());
+                }
+                else if (accept('/')) {
+                    left = operation(OP_DIV, left, unary());
+                }
+                else {
+                    return left;
+                }
+            }
+        }
+
+        Operand unary() {
+            if (accept('-')) {
+                return operation(OP_NEG, unary());
+            }
+            accept('+');
+            return power();
+        }
+
+        // Right associative, and binds tighter than unary minus on its left: -x^2 is -(x^2)
+        Operand power() {
+            Operand base = primary();
+            if (accept('^')) {
+                return operation(OP_POW, base, unary());
+            }
+            return base;
+        }
+
+        Operand primary() {
+            skipSpace();
+            if (pos >= source.size()) {
+                fail("Unexpected end");
+            }
+
+            if (accept('(')) {
+                Operand inner = expression();
+                expect(')');
+                return inner;
+            }
+
+            char c = source[pos];
+            if (isdigit((unsigned char)c) || c == '.') {
+                const char* begin = source.c_str() + pos;
+                char* end;
+                float value = strtof(begin, &end);
+                if (end == begin) {
+                    fail("Malformed number");
+                }
+                pos += end - begin;
+                return constant(value);
+            }
+
+            if (isalpha((unsigned char)c)) {
+                size_t begin = pos;
+                while (pos < source.size() && (isalnum((unsigned char)source[pos]) || source[pos] == '_')) {
+                    pos++;
+                }
+                string name = source.substr(begin, pos - begin);
+                return identifier(name, begin);
+            }
+
+            fail("Unexpected character");
+            return constant(0);
+        }
+
+        Operand identifier(const string& name, size_t begin) {
+            if (name == "x" || name == "y" || name == "z") {
+                Operand variable;
+                variable.constant = false;
+                variable.value = 0;
+                variable.reg = name[0] - 'x';
+                return variable;
+            }
+            if (name == "pi") {
+                return constant(3.14159265358979f);
+            }
+
+            for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+                if (name != functions[f].name) {
+                    continue;
+                }
+                expect('(');
+                Operand a = expression();
+                if (functions[f].args == 1) {
+                    expect(')');
+                    return operation(functions[f].op, a);
+                }
+                expect(',');
+                Operand b = expression();
+                expect(')');
+                return operation(functions[f].op, a, b);
+            }
+
+            pos = begin;
+            fail(("Unknown name '" + name + "'").c_str());
+            return constant(0);
+        }
+    };
+
+    ExpressionField::ExpressionField() :
+        result(0)
+    {
+    }
+
+    ExpressionField::ExpressionField(const string& source) :
+        text(source),
+        result(0)
+    {
+        ExpressionCompiler compiler(text, *this);
+        compiler.compile();
+    }
+
+    const string& ExpressionField::source() const {
+        return text;
+    }
+
+#ifdef MC_SIMD
+    static void load(const float* p, simd::Float4& v) {
+        v = simd::Float4::load(p);
+    }
+
+    static void store(float* p, simd::Float4 v) {
+        v.store(p);
+    }
+#else
+    static void load(const float* p, float& v) {
+        v = *p;
+    }
+
+    static void store(float* p, float v) {
+        *p = v;
+    }
+#endif
+
+    // Runs every instruction over lanes lanes of the registers, T wide at a time. The
+    // operation is picked once per instruction, each case a tight loop over the lanes.
+    // Operations without a vector version go through apply one lane at a time.
+    template <typename T>
+    static void run(const vector<ExpressionField::Instruction>& code, float (*regs)[BATCH_LANES], int lanes) {
+        const int step = sizeof(T) / sizeof(float);
+
+        for (size_t n = 0; n < code.size(); n++) {
+            const ExpressionField::Instruction& ins = code[n];
+            float* d = regs[ins.dst];
+            const float* a = regs[ins.a];
+            const float* b = regs[ins.b];
+            T va, vb;
+
+            switch (ins.op) {
+            case OP_CONST:
+                for (int i = 0; i < lanes; i += step) {
+                    store(d + i, T(ins.imm));
+                }
+                break;
+            case OP_NEG:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    store(d + i, -va);
+                }
+                break;
+            case OP_ADD:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, va + vb);
+                }
+                break;
+            case OP_SUB:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, va - vb);
+                }
+                break;
+            case OP_MUL:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, va * vb);
+                }
+                break;
+            case OP_DIV:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, va / vb);
+                }
+                break;
+            case OP_MIN:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, simd::min(va, vb));
+                }
+                break;
+            case OP_MAX:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    load(b + i, vb);
+                    store(d + i, simd::max(va, vb));
+                }
+                break;
+            case OP_SIN:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    store(d + i, simd::sin(va));
+                }
+                break;
+            case OP_COS:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    store(d + i, simd::cos(va));
+                }
+                break;
+            case OP_SQRT:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    store(d + i, simd::sqrt(va));
+                }
+                break;
+            case OP_ABS:
+                for (int i = 0; i < lanes; i += step) {
+                    load(a + i, va);
+                    store(d + i, simd::abs(va));
+                }
+                break;
+            default:
+                for (int i = 0; i < lanes; i++) {
+                    d[i] = apply(ins.op, a[i], b[i]);
+                }
+                break;
+            }
+        }
+    }
+
+    float ExpressionField::value(float x, float y, float z) const {
+        float v;
+        valueBatch(&x, &y, &z, 1, &v);
+        return v;
+    }
+
+    void ExpressionField::valueBatch(const float* x, const float* y, const float* z, int count, float* values) const {
+        float regs[MAX_REGISTERS][BATCH_LANES];
+
+        for (int begin = 0; begin < count; begin += BATCH_LANES) {
+            int n = min(BATCH_LANES, count - begin);
+#ifdef MC_SIMD
+            // Whole vectors, the padding lanes compute garbage that is never read
+            int lanes = (n + simd::LANES - 1) / simd::LANES * simd::LANES;
+#else
+            int lanes = n;
+#endif
+            for (int i = 0; i < lanes; i++) {
+                regs[0][i] = i < n ? x[begin + i] : 0;
+                regs[1][i] = i < n ? y[begin + i] : 0;
+                regs[2][i] = i < n ? z[begin + i] : 0;
+            }
+
+#ifdef MC_SIMD
+            run<simd::Float4>(code, regs, lanes);
+#else
+            run<float>(code, regs, lanes);
+#endif
+
+            for (int i = 0; i < n; i++) {
+                values[begin + i] = regs[result][i];
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#ifndef _Expression_H_
+#define _Expression_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Field.h"
+
+namespace mc {
+
+    // Field given by an expression in x, y and z, compiled at runtime, for example
+    // "sqrt(x*x + y*y) - 10 + sin(z)". Supports + - * / ^, unary minus, parentheses,
+    // numbers, pi and the functions sin, cos, tan, sqrt, abs, exp, log, floor, min, max
+    // and pow. Constant subexpressions are folded, the rest compiles to a register
+    // bytecode that each valueBatch runs once over a whole batch of points.
+    class ExpressionField : public Field {
+    public:
+        ExpressionField();
+        // Throws invalid_argument if source does not parse
+        explicit ExpressionField(const std::string& source);
+
+        const std::string& source() const;
+
+        float value(float x, float y, float z) const;
+        void valueBatch(const float* x, const float* y, const float* z, int count, float* values) const;
+
+        // dst = op(a, b) over every lane of the registers, imm holds the value of a constant
+        struct Instruction {
+            uint8_t op;
+            uint8_t dst, a, b;
+            float imm;
+        };
+
+    private:
+        std::string text;
+        std::vector<Instruction> code;
+        // Register holding the result
+        int result;
+
+        friend class ExpressionCompiler;
+    };
+}
+
+#endif /* _Expression_H_ */
@@ -0,0 +1,152 @@
+#include "Field.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Angular frequency of the ripples along the distance from the z axis
+#define RIPPLE_FREQUENCY (.1f*3.14f)
+// Points per valueBatch call when sampling a row
+#define ROW_CHUNK 64
+
+using namespace glm;
+using namespace std;
+
+namespace mc {
+
+    Field::~Field() {
+    }
+
+    vec3 Field::gradient(float x, float y, float z, vec3 h) const {
+        float xl, xg, yl, yg, zl, zg;
+
+        xl = value(x - h.x, y, z);
+        xg = value(x + h.x, y, z);
+        yl = value(x, y - h.y, z);
+        yg = value(x, y + h.y, z);
+        zl = value(x, y, z - h.z);
+        zg = value(x, y, z + h.z);
+
+        return vec3((xg - xl) / (2 * h.x), (yg - yl) / (2 * h.y), (zg - zl) / (2 * h.z));
+    }
+
+    void Field::valueBatch(const float* x, const float* y, const float* z, int count, float* values) const {
+        for (int i = 0; i < count; i++) {
+            values[i] = value(x[i], y[i], z[i]);
+        }
+    }
+
+    void Field::valueRow(float x, float y, float z, float dx, int count, float* values) const {
+        float xs[ROW_CHUNK], ys[ROW_CHUNK], zs[ROW_CHUNK];
+        fill(ys, ys + ROW_CHUNK, y);
+        fill(zs, zs + ROW_CHUNK, z);
+
+        for (int begin = 0; begin < count; begin += ROW_CHUNK) {
+            int n = min(ROW_CHUNK, count - begin);
+            for (int i = 0; i < n; i++) {
+                xs[i] = x + dx * (begin + i);
+            }
+            valueBatch(xs, ys, zs, n, values + begin);
+        }
+    }
+
+    void Field::gradientRow(float x, float y, float z, float dx, int count, vec3 h, vec3* gradients) const {
+        for (int i = 0; i < count; i++) {
+            gradients[i] = gradient(x + dx * i, y, z, h);
+        }
+    }
+
+    bool Field::bounds(vec3, vec3, float&, float&) const {
+        return false;
+    }
+
+    bool Field::boundsBlocks(vec3&, vec3&) const {
+        return false;
+    }
+
+    static float sign(float v) {
+        return (float)((v > 0) - (v < 0));
+    }
+
+    struct Ripples {
+        template <typename T>
+        static T value(T x, T y, T z) {
+            return .003f * z*z - simd::cos(RIPPLE_FREQUENCY*simd::sqrt(x*x + y*y));
+        }
+
+        static vec3 gradient(float x, float y, float z, vec3) {
+            float r = sqrt(x*x + y*y);
+            // d/dr of -cos(k r) is k sin(k r), which tends to k^2 r on the axis
+            float radial = r > 0 ? RIPPLE_FREQUENCY * sin(RIPPLE_FREQUENCY * r) / r : RIPPLE_FREQUENCY * RIPPLE_FREQUENCY;
+            return vec3(radial * x, radial * y, .006f * z);
+        }
+    };
+
+    struct Sphere {
+        template <typename T>
+        static T value(T x, T y, T z) {
+            return x*x + y*y + z*z - 2500;
+        }
+
+        static vec3 gradient(float x, float y, float z, vec3) {
+            return vec3(2 * x, 2 * y, 2 * z);
+        }
+    };
+
+    struct Cylinder {
+        template <typename T>
+        static T value(T x, T y, T) {
+            return -simd::abs(10 - simd::sqrt(x*x + y*y)) + 2;
+        }
+
+        static vec3 gradient(float x, float y, float, vec3) {
+            float r = sqrt(x*x + y*y);
+            if (r == 0) {
+                return vec3(0);
+            }
+            float radial = sign(10 - r) / r;
+            return vec3(radial * x, radial * y, 0);
+        }
+    };
+
+    struct Cube {
+        template <typename T>
+        static T value(T x, T y, T z) {
+            return simd::max(simd::max(simd::abs(x), simd::abs(y)), simd::abs(z)) - 30;
+        }
+
+        // Normal of the face the point is closest to
+        static vec3 gradient(float x, float y, float z, vec3) {
+            if (abs(x) >= abs(y) && abs(x) >= abs(z)) {
+                return vec3(sign(x), 0, 0);
+            }
+            if (abs(y) >= abs(z)) {
+                return vec3(0, sign(y), 0);
+            }
+            return vec3(0, 0, sign(z));
+        }
+    };
+
+    const Field& builtin_field(Function function) {
+        static const FunctorField<Ripples> ripples;
+        static const FunctorField<Sphere> sphere;
+        static const FunctorField<Cylinder> cylinder;
+        static const FunctorField<Cube> cube;
+
+        switch (function) {
+        case RIPPLES:
+            return ripples;
+        case SPHERE:
+            return sphere;
+        case CYLINDER:
+            return cylinder;
+        case CUBE:
+            return cube;
+        }
+        throw invalid_argument("Unknown function");
+    }
+
+    float data_function(Function function, float x, float y, float z) {
+        return builtin_field(function).value(x, y, z);
+    }
+}
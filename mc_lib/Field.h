@@ -0,0 +1,91 @@
+#pragma once
+#ifndef _Field_H_
+#define _Field_H_
+
+#include <glm/glm.hpp>
+
+#include "SimdMath.h"
+
+namespace mc {
+
+    // Built-in implicit functions that can be sampled over the grid
+    enum Function {
+        RIPPLES,
+        SPHERE,
+        CYLINDER,
+        CUBE
+    };
+
+    // Scalar field sampled by an extractor
+    class Field {
+    public:
+        virtual ~Field();
+
+        virtual float value(float x, float y, float z) const = 0;
+
+        // Gradient at (x, y, z). Defaults to central differences of six values h apart
+        // along each axis, fields with a closed form override it.
+        virtual glm::vec3 gradient(float x, float y, float z, glm::vec3 h) const;
+
+        // Values at the count points (x[i], y[i], z[i]). Defaults to a value call per point,
+        // fields with vectorized math override it.
+        virtual void valueBatch(const float* x, const float* y, const float* z, int count, float* values) const;
+        // Values at the count points dx apart along x from (x, y, z), point i at x + dx * i,
+        // evaluated through valueBatch a chunk at a time
+        virtual void valueRow(float x, float y, float z, float dx, int count, float* values) const;
+        // Gradients at the same points, defaults to a gradient call per point
+        virtual void gradientRow(float x, float y, float z, float dx, int count, glm::vec3 h, glm::vec3* gradients) const;
+
+        // Bounds of the values in the box from lo to hi, for fields that know them without
+        // evaluating the box, such as bricked volumes. The bounds may be loose but must hold
+        // every value. Returns false when unknown, which is the default.
+        virtual bool bounds(glm::vec3 lo, glm::vec3 hi, float& min, float& max) const;
+        // Corner and size of the blocks bounds is answered from, for fields that keep
+        // bounds per block of a regular lattice. A box within one block, faces included,
+        // gets the bounds of that block alone. Returns false for other fields, the default.
+        virtual bool boundsBlocks(glm::vec3& origin, glm::vec3& size) const;
+    };
+
+    // Field whose math is known at compile time. F provides static gradient(x, y, z, h)
+    // and value(x, y, z) as a template over float and simd::Float4, written with the
+    // simd math functions. Both are inlined into the batch loops, which evaluate four
+    // points per call of value where SSE2 is available. Only the batch calls are
+    // dispatched at runtime.
+    template <typename F>
+    class FunctorField : public Field {
+    public:
+        float value(float x, float y, float z) const {
+            return F::value(x, y, z);
+        }
+
+        glm::vec3 gradient(float x, float y, float z, glm::vec3 h) const {
+            return F::gradient(x, y, z, h);
+        }
+
+        void valueBatch(const float* x, const float* y, const float* z, int count, float* values) const {
+            int i = 0;
+#ifdef MC_SIMD
+            for (; i + simd::LANES <= count; i += simd::LANES) {
+                F::value(simd::Float4::load(x + i), simd::Float4::load(y + i), simd::Float4::load(z + i)).store(values + i);
+            }
+#endif
+            for (; i < count; i++) {
+                values[i] = F::value(x[i], y[i], z[i]);
+            }
+        }
+
+        void gradientRow(float x, float y, float z, float dx, int count, glm::vec3 h, glm::vec3* gradients) const {
+            for (int i = 0; i < count; i++) {
+                gradients[i] = F::gradient(x + dx * i, y, z, h);
+            }
+        }
+    };
+
+    // Field of a built-in function, with its analytic gradient
+    const Field& builtin_field(Function function);
+
+    // Evaluates a built-in function at a point
+    float data_function(Function function, float x, float y, float z);
+}
+
+#endif /* _Field_H_ */
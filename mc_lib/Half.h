@@ -0,0 +1,73 @@
+#pragma once
+#ifndef _Half_H_
+#define _Half_H_
+
+#include <cstdint>
+#include <cstring>
+
+namespace mc {
+
+    // IEEE 754 binary16 storage type. Converts to and from float with round to nearest
+    // even, all arithmetic happens in float.
+    struct Half {
+        uint16_t bits;
+
+        Half() {}
+
+        Half(float f) {
+            uint32_t x;
+            memcpy(&x, &f, sizeof(x));
+            uint16_t sign = (uint16_t)((x >> 16) & 0x8000);
+            uint32_t abs = x & 0x7fffffff;
+
+            if (abs >= 0x7f800000) {
+                // Infinity stays infinity, NaN stays a quiet NaN
+                bits = sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+            }
+            else if (abs >= 0x477ff000) {
+                // Rounds past the largest half
+                bits = sign | 0x7c00;
+            }
+            else if (abs < 0x38800000) {
+                // Subnormal or zero: adding 0.5 leaves the value in units of 2^-24 in
+                // the low mantissa bits, rounded by the float addition
+                float magic;
+                memcpy(&magic, &abs, sizeof(magic));
+                magic += 0.5f;
+                uint32_t m;
+                memcpy(&m, &magic, sizeof(m));
+                bits = sign | (uint16_t)(m - 0x3f000000);
+            }
+            else {
+                // Rebias the exponent and round the mantissa to 10 bits, ties to even
+                uint32_t odd = (abs >> 13) & 1;
+                abs += 0xc8000fff + odd;
+                bits = sign | (uint16_t)(abs >> 13);
+            }
+        }
+
+        operator float() const {
+            uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+            uint32_t abs = bits & 0x7fff;
+            uint32_t x;
+
+            if (abs >= 0x7c00) {
+                x = 0x7f800000 | (abs & 0x3ff) << 13;
+            }
+            else if (abs >= 0x400) {
+                x = (abs << 13) + 0x38000000;
+            }
+            else {
+                float subnormal = (float)abs * 5.9604645e-08f;
+                memcpy(&x, &subnormal, sizeof(x));
+            }
+
+            x |= sign;
+            float f;
+            memcpy(&f, &x, sizeof(f));
+            return f;
+        }
+    };
+}
+
+#endif /* _Half_H_ */
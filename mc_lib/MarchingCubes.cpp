@@ -0,0 +1,1258 @@
+#include "MarchingCubes.h"
+
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+
+#include "Classify.h"
+#include "LookupTables.h"
+
+#define VOX_VERTS 8
+#define EDGE_VERTS 12
+#define NO_VERT -1
+// Cell slices per slab task for every thread in the pool, extra slabs even out the load
+#define SLABS_PER_THREAD 4
+// States of a lazily computed gradient
+#define GRADIENT_MISSING 0
+#define GRADIENT_WRITING 1
+#define GRADIENT_READY 2
+// Sample slices in the ring of a StreamingExtractor
+#define STREAM_SLICES 5
+// Cells per run a StreamingExtractor queries bounds for, when the field has no blocks
+#define STREAM_RUN 32
+// How far block sizes and corners may be from whole cells and still line up with them
+#define BLOCK_TOLERANCE 1e-3f
+
+using namespace glm;
+using namespace std;
+
+namespace mc {
+
+    Grid::Grid() :
+        nx(0),
+        ny(0),
+        nz(0),
+        origin(0),
+        spacing(1)
+    {
+    }
+
+    Grid::Grid(int nx, int ny, int nz, vec3 origin, vec3 spacing) :
+        nx(nx),
+        ny(ny),
+        nz(nz),
+        origin(origin),
+        spacing(spacing)
+    {
+    }
+
+    Grid Grid::centered(int grid_size) {
+        float corner = (float)-(grid_size / 2);
+        return Grid(grid_size, grid_size, grid_size, vec3(corner), vec3(1));
+    }
+
+    size_t Grid::samples() const {
+        return (size_t)nx * ny * nz;
+    }
+
+    vec3 Grid::position(int x, int y, int z) const {
+        return vec3(origin.x + spacing.x * x, origin.y + spacing.y * y, origin.z + spacing.z * z);
+    }
+
+    bool Grid::operator==(const Grid& other) const {
+        return nx == other.nx && ny == other.ny && nz == other.nz &&
+            origin == other.origin && spacing == other.spacing;
+    }
+
+    bool Grid::operator!=(const Grid& other) const {
+        return !(*this == other);
+    }
+
+    // Unique across all extractors, so no extractor mistakes another's mesh for its own
+    static uint64_t next_generation() {
+        static atomic<uint64_t> last(0);
+        return ++last;
+    }
+
+    template <typename Scalar>
+    BasicExtractor<Scalar>::BasicExtractor(ThreadPool* pool) :
+        field(NULL),
+        isovalue(0),
+        gradient_mode(GRADIENT_FUNCTION),
+        lazy_gradients(false),
+        field_valid(false),
+        extracted(false),
+        extracted_isovalue(0),
+        extracted_generation(0),
+        pool(pool),
+        gradient_blocks_x(0),
+        gradient_blocks_y(0),
+        sign_row_words(0)
+    {
+    }
+
+    template <typename Scalar>
+    BasicExtractor<Scalar>::~BasicExtractor() {
+        freeGradientBlocks();
+    }
+
+    template <typename Scalar>
+    BasicExtractor<Scalar>::GradientBlock::GradientBlock() {
+        for (int i = 0; i < BRICK_SIZE * BRICK_SIZE * BRICK_SIZE; i++) {
+            state[i].store(GRADIENT_MISSING, memory_order_relaxed);
+        }
+    }
+
+    template <typename Scalar>
+    size_t BasicExtractor<Scalar>::sampleIndex(int x, int y, int z) {
+        return ((size_t)z * grid.ny + y) * grid.nx + x;
+    }
+
+    template <typename Scalar>
+    Scalar& BasicExtractor<Scalar>::sampleValue(int x, int y, int z) {
+        return values[sampleIndex(x, y, z)];
+    }
+
+    template <typename Scalar>
+    typename BasicExtractor<Scalar>::Gradient& BasicExtractor<Scalar>::sampleGradient(int x, int y, int z) {
+        return gradients[sampleIndex(x, y, z)];
+    }
+
+    template <typename Scalar>
+    typename BasicExtractor<Scalar>::GradientBlock& BasicExtractor<Scalar>::gradientBlock(int x, int y, int z) {
+        size_t b = ((size_t)(z / BRICK_SIZE) * gradient_blocks_y + y / BRICK_SIZE) * gradient_blocks_x + x / BRICK_SIZE;
+        GradientBlock* block = gradient_blocks[b].load(memory_order_acquire);
+        if (!block) {
+            // Threads that race to allocate the block keep whichever was published first
+            GradientBlock* allocated = new GradientBlock();
+            if (gradient_blocks[b].compare_exchange_strong(block, allocated, memory_order_acq_rel, memory_order_acquire)) {
+                block = allocated;
+            }
+            else {
+                delete allocated;
+            }
+        }
+        return *block;
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::freeGradientBlocks() {
+        for (size_t b = 0; b < gradient_blocks.size(); b++) {
+            delete gradient_blocks[b].load(memory_order_relaxed);
+        }
+        gradient_blocks = vector<atomic<GradientBlock*> >();
+    }
+
+    template <typename Scalar>
+    Voxel& BasicExtractor<Scalar>::sliceVoxel(vector<Voxel>& slice, int x, int y) {
+        return slice[(size_t)y * (grid.nx - 1) + x];
+    }
+
+    template <typename Scalar>
+    float BasicExtractor<Scalar>::valueAt(pt3 pt) {
+        return sampleValue(pt.x, pt.y, pt.z);
+    }
+
+    template <typename Scalar>
+    vec3 BasicExtractor<Scalar>::normalAt(pt3 pt) {
+        if (!lazy_gradients) {
+            return sampleGradient(pt.x, pt.y, pt.z);
+        }
+
+        GradientBlock& block = gradientBlock(pt.x, pt.y, pt.z);
+        int i = ((pt.z % BRICK_SIZE) * BRICK_SIZE + pt.y % BRICK_SIZE) * BRICK_SIZE + pt.x % BRICK_SIZE;
+        uint8_t state = block.state[i].load(memory_order_acquire);
+        if (state == GRADIENT_READY) {
+            return block.gradients[i];
+        }
+
+        // The first thread to claim the sample stores the gradient. Threads that reach it
+        // before it is published use their own copy, which is the same value.
+        vec3 gradient = gradient_mode == GRADIENT_FUNCTION ? functionGradient(pt.x, pt.y, pt.z) : differenceGradient(pt.x, pt.y, pt.z);
+        if (state == GRADIENT_MISSING && block.state[i].compare_exchange_strong(state, GRADIENT_WRITING, memory_order_relaxed)) {
+            block.gradients[i] = gradient;
+            block.state[i].store(GRADIENT_READY, memory_order_release);
+        }
+        return gradient;
+    }
+
+    // Vertex and normal where the isosurface crosses the edge from sample p1 to sample p2
+    static vec3* interpolate_edge(const Grid& grid, float isovalue, pt3 p1, pt3 p2, float val1, float val2, vec3 norm1, vec3 norm2, vec3* ret) {
+        float mu;
+
+        mu = (isovalue - val1) / (val2 - val1);
+        ret[0].x = grid.origin.x + grid.spacing.x * (p1.x + mu * (p2.x - p1.x));
+        ret[0].y = grid.origin.y + grid.spacing.y * (p1.y + mu * (p2.y - p1.y));
+        ret[0].z = grid.origin.z + grid.spacing.z * (p1.z + mu * (p2.z - p1.z));
+        ret[1] = normalize(norm2 * mu + norm1 * (1 - mu));
+        return ret;
+    }
+
+    static Voxel get_voxel(int x, int y, int z) {
+        Voxel vox;
+        for (int e = 0; e < EDGE_VERTS; e++) {
+            vox.edges[e] = -1;
+        }
+        vox.verts[0] = pt3(x, y, z);
+        vox.verts[1] = pt3(x + 1, y, z);
+        vox.verts[2] = pt3(x + 1, y, z + 1);
+        vox.verts[3] = pt3(x, y, z + 1);
+        vox.verts[4] = pt3(x, y + 1, z);
+        vox.verts[5] = pt3(x + 1, y + 1, z);
+        vox.verts[6] = pt3(x + 1, y + 1, z + 1);
+        vox.verts[7] = pt3(x, y + 1, z + 1);
+        return vox;
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::sampleSlice(int z) {
+        vector<float> row(grid.nx);
+        vector<vec3> gradient_row;
+        if (gradient_mode == GRADIENT_FUNCTION && !lazy_gradients) {
+            gradient_row.resize(grid.nx);
+        }
+
+        // One call per row, the field's own loop covers the samples
+        for (int y = 0; y < grid.ny; y++) {
+            vec3 p = grid.position(0, y, z);
+            field->valueRow(p.x, p.y, p.z, grid.spacing.x, grid.nx, row.data());
+
+            Scalar* values_row = &sampleValue(0, y, z);
+            for (int x = 0; x < grid.nx; x++) {
+                values_row[x] = row[x];
+            }
+
+            if (gradient_mode == GRADIENT_FUNCTION && !lazy_gradients) {
+                field->gradientRow(p.x, p.y, p.z, grid.spacing.x, grid.nx, grid.spacing, gradient_row.data());
+
+                Gradient* gradients_row = &sampleGradient(0, y, z);
+                for (int x = 0; x < grid.nx; x++) {
+                    gradients_row[x] = gradient_row[x];
+                }
+            }
+        }
+    }
+
+    template <typename Scalar>
+    vec3 BasicExtractor<Scalar>::functionGradient(int x, int y, int z) {
+        vec3 p = grid.position(x, y, z);
+        return field->gradient(p.x, p.y, p.z, grid.spacing);
+    }
+
+    // Difference of the samples around (x, y, z) along one axis, scaled to match a
+    // central difference. Boundary samples, and neighbours that known(x, y, z) rejects,
+    // fall back to a one-sided difference. value(x, y, z) reads a sample.
+    template <typename Values, typename Known>
+    static float sample_difference(const Grid& grid, const Values& value, const Known& known, int x, int y, int z, int dx, int dy, int dz) {
+        int lo_x = x - dx, lo_y = y - dy, lo_z = z - dz;
+        int hi_x = x + dx, hi_y = y + dy, hi_z = z + dz;
+        float scale = 1;
+        if (lo_x < 0 || lo_y < 0 || lo_z < 0 || !known(lo_x, lo_y, lo_z)) {
+            lo_x = x;
+            lo_y = y;
+            lo_z = z;
+            scale = 2;
+        }
+        if (hi_x >= grid.nx || hi_y >= grid.ny || hi_z >= grid.nz || !known(hi_x, hi_y, hi_z)) {
+            hi_x = x;
+            hi_y = y;
+            hi_z = z;
+            scale = 2;
+        }
+        return scale * (value(hi_x, hi_y, hi_z) - value(lo_x, lo_y, lo_z));
+    }
+
+    template <typename Values>
+    static float sample_difference(const Grid& grid, const Values& value, int x, int y, int z, int dx, int dy, int dz) {
+        return sample_difference(grid, value, [](int, int, int) {
+            return true;
+        }, x, y, z, dx, dy, dz);
+    }
+
+    template <typename Scalar>
+    float BasicExtractor<Scalar>::sampleDifference(int x, int y, int z, int dx, int dy, int dz) {
+        return sample_difference(grid, [this](int x, int y, int z) {
+            return (float)sampleValue(x, y, z);
+        }, x, y, z, dx, dy, dz);
+    }
+
+    template <typename Scalar>
+    vec3 BasicExtractor<Scalar>::differenceGradient(int x, int y, int z) {
+        const vec3& h = grid.spacing;
+        return vec3(
+            sampleDifference(x, y, z, 1, 0, 0) / h.x,
+            sampleDifference(x, y, z, 0, 1, 0) / h.y,
+            sampleDifference(x, y, z, 0, 0, 1) / h.z);
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::differenceSlice(int z) {
+        for (int y = 0; y < grid.ny; y++) {
+            for (int x = 0; x < grid.nx; x++) {
+                sampleGradient(x, y, z) = differenceGradient(x, y, z);
+            }
+        }
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::computeValues() {
+        parallel_for(pool, grid.nz, [this](int z) {
+            sampleSlice(z);
+        });
+
+        // Gradients from samples need the neighboring slices, so they run as a second pass
+        if (gradient_mode == GRADIENT_SAMPLES && !lazy_gradients) {
+            parallel_for(pool, grid.nz, [this](int z) {
+                differenceSlice(z);
+            });
+        }
+    }
+
+    template <typename Scalar>
+    vec3* BasicExtractor<Scalar>::interpolate(pt3 p1, pt3 p2, vec3* ret) {
+        float val1 = valueAt(p1);
+        float val2 = valueAt(p2);
+        vec3 norm1 = normalAt(p1);
+        vec3 norm2 = normalAt(p2);
+        return interpolate_edge(grid, isovalue, p1, p2, val1, val2, norm1, norm2, ret);
+    }
+
+    // Encodes a reference to edge n of cell (x, y) in the last slice of the slab below
+    static int seam_ref(int cell, int n) {
+        return -2 - (cell * EDGE_VERTS + n);
+    }
+
+    // Edge of the x-1, y-1 and z-1 neighbor that coincides with each edge of a cell,
+    // or -1 where the edge is not on that face
+    static const int x_neighbor_edge[EDGE_VERTS] = {-1, -1, -1, 1, -1, -1, -1, 5, 9, -1, -1, 10};
+    static const int y_neighbor_edge[EDGE_VERTS] = {4, 5, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1};
+    static const int z_neighbor_edge[EDGE_VERTS] = {2, -1, -1, -1, 6, -1, -1, -1, 11, 10, -1, -1};
+
+    // Looks up the vertex already emitted on edge e of cell (x, y, z) by the y-1 or x-1
+    // neighbor in the current slice or by the z-1 neighbor in the previous slice
+    template <typename Scalar>
+    int BasicExtractor<Scalar>::getVertIdx(Slab& slab, int x, int y, int z, int e) {
+        int elem = NO_VERT;
+        if (y > 0 && y_neighbor_edge[e] >= 0) {
+            elem = sliceVoxel(*slab.current_vox, x, y - 1).edges[y_neighbor_edge[e]];
+        }
+        if (elem == NO_VERT && x > 0 && x_neighbor_edge[e] >= 0) {
+            elem = sliceVoxel(*slab.current_vox, x - 1, y).edges[x_neighbor_edge[e]];
+        }
+        if (elem == NO_VERT && z > 0 && z_neighbor_edge[e] >= 0) {
+            int n = z_neighbor_edge[e];
+            if (z > slab.z_begin) {
+                elem = sliceVoxel(*slab.prev_vox, x, y).edges[n];
+            }
+            else {
+                elem = seam_ref(y * (grid.nx - 1) + x, n);
+            }
+        }
+        return elem;
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::swapSlices(Slab& slab) {
+        vector<Voxel>* c = slab.current_vox;
+        slab.current_vox = slab.prev_vox;
+        slab.prev_vox = c;
+    }
+
+    // Triangle count of every cube case, derived from triTable
+    struct CaseCounts {
+        int tris[256];
+
+        CaseCounts() {
+            for (int idx = 0; idx < 256; idx++) {
+                int n = 0;
+                while (triTable[idx][n] != -1) {
+                    n++;
+                }
+                tris[idx] = n / 3;
+            }
+        }
+    };
+
+    static const CaseCounts& case_counts() {
+        static const CaseCounts counts;
+        return counts;
+    }
+
+    // Edges of cell (x, y, z) that emit a new vertex rather than reuse one from a lower
+    // neighbor, matching getVertIdx: edges 5, 6 and 10 always, the rest only on the
+    // low faces of the grid
+    static int owned_edges(int x, int y, int z) {
+        int mask = (1 << 5) | (1 << 6) | (1 << 10);
+        if (x == 0) {
+            mask |= (1 << 7) | (1 << 11);
+        }
+        if (y == 0) {
+            mask |= (1 << 1) | (1 << 2);
+        }
+        if (z == 0) {
+            mask |= (1 << 4) | (1 << 9);
+        }
+        if (y == 0 && z == 0) {
+            mask |= 1 << 0;
+        }
+        if (x == 0 && y == 0) {
+            mask |= 1 << 3;
+        }
+        if (x == 0 && z == 0) {
+            mask |= 1 << 8;
+        }
+        return mask;
+    }
+
+    static int bit_count(int bits) {
+        int n = 0;
+        for (; bits; bits &= bits - 1) {
+            n++;
+        }
+        return n;
+    }
+
+    // Fills the level 0 ranges of brick slice bz from the samples at the brick corners
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::computeBrickSlice(int bz) {
+        for (int by = 0; by < bricks.bricksY(); by++) {
+            for (int bx = 0; bx < bricks.bricksX(); bx++) {
+                BrickPyramid::Range range;
+                range.min = range.max = sampleValue(bx * BRICK_SIZE, by * BRICK_SIZE, bz * BRICK_SIZE);
+
+                int x_end = min((bx + 1) * BRICK_SIZE, grid.nx - 1);
+                int y_end = min((by + 1) * BRICK_SIZE, grid.ny - 1);
+                int z_end = min((bz + 1) * BRICK_SIZE, grid.nz - 1);
+                for (int z = bz * BRICK_SIZE; z <= z_end; z++) {
+                    for (int y = by * BRICK_SIZE; y <= y_end; y++) {
+                        for (int x = bx * BRICK_SIZE; x <= x_end; x++) {
+                            float value = sampleValue(x, y, z);
+                            range.min = min(range.min, value);
+                            range.max = max(range.max, value);
+                        }
+                    }
+                }
+                bricks.brick(bx, by, bz) = range;
+            }
+        }
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::computeBricks() {
+        bricks.resize(grid.nx, grid.ny, grid.nz);
+        parallel_for(pool, bricks.bricksZ(), [this](int bz) {
+            computeBrickSlice(bz);
+        });
+        bricks.buildLevels();
+    }
+
+    template <typename Scalar>
+    const uint64_t* BasicExtractor<Scalar>::brickRow(const vector<uint64_t>& mask, int by, int bz) {
+        return &mask[((size_t)bz * bricks.bricksY() + by) * bricks.rowWords()];
+    }
+
+    // Packs the signs of slice z relative to the isovalue into the sign bitset. Only the
+    // words that hold samples of the bricks in mask are written. Returns whether any of
+    // them changed.
+    template <typename Scalar>
+    bool BasicExtractor<Scalar>::packSigns(int z, const vector<uint64_t>& mask) {
+        vector<uint64_t> touching(bricks.rowWords());
+        bool changed = false;
+
+        for (int y = 0; y < grid.ny; y++) {
+            // Bricks with samples on this row: samples on a brick boundary
+            // belong to the bricks on both sides
+            fill(touching.begin(), touching.end(), 0);
+            for (int bz = (z - 1) / BRICK_SIZE; bz <= z / BRICK_SIZE; bz++) {
+                for (int by = (y - 1) / BRICK_SIZE; by <= y / BRICK_SIZE; by++) {
+                    if (bz < 0 || bz >= bricks.bricksZ() || by < 0 || by >= bricks.bricksY()) {
+                        continue;
+                    }
+                    const uint64_t* row = brickRow(mask, by, bz);
+                    for (int w = 0; w < bricks.rowWords(); w++) {
+                        touching[w] |= row[w];
+                    }
+                }
+            }
+
+            const Scalar* row = &sampleValue(0, y, z);
+            uint64_t* bits = &signs[((size_t)z * grid.ny + y) * sign_row_words];
+            for (int w = 0; w < sign_row_words; w++) {
+                bool needed = false;
+                int bx_end = min((w * 64 + 63) / BRICK_SIZE, bricks.bricksX() - 1);
+                for (int bx = max((w * 64 - 1) / BRICK_SIZE, 0); bx <= bx_end && !needed; bx++) {
+                    needed = (touching[bx / 64] >> (bx % 64)) & 1;
+                }
+                if (!needed) {
+                    continue;
+                }
+
+                uint64_t word = sign_word(row + w * 64, min(64, grid.nx - w * 64), isovalue);
+                changed |= bits[w] != word;
+                bits[w] = word;
+            }
+        }
+        return changed;
+    }
+
+    template <typename Scalar>
+    const uint64_t* BasicExtractor<Scalar>::signRow(int y, int z) {
+        return &signs[((size_t)z * grid.ny + y) * sign_row_words];
+    }
+
+    // First pass: classifies the cells of the slab's active bricks from the sign bitset,
+    // keeps the ones the surface crosses and counts the vertices and indices they will emit
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::classifySlab(Slab& slab) {
+        const CaseCounts& counts = case_counts();
+
+        slab.active.clear();
+        slab.vert_count = 0;
+        slab.elem_count = 0;
+
+        slab.row_active.resize(grid.nx - 1);
+        slab.cubes.resize(grid.nx - 1);
+
+        for (int z = slab.z_begin; z < slab.z_end; z++) {
+            for (int y = 0; y < grid.ny - 1; y++) {
+                const uint64_t* brick_row = brickRow(active_bricks, y / BRICK_SIZE, z / BRICK_SIZE);
+
+                // Runs of active bricks along x, in order so cells stay sorted by x
+                int bx = 0;
+                while (bx < bricks.bricksX()) {
+                    if (!((brick_row[bx / 64] >> (bx % 64)) & 1)) {
+                        bx++;
+                        continue;
+                    }
+                    int run_end = bx + 1;
+                    while (run_end < bricks.bricksX() && ((brick_row[run_end / 64] >> (run_end % 64)) & 1)) {
+                        run_end++;
+                    }
+
+                    int found = classify_cells(signRow(y, z), signRow(y, z + 1), signRow(y + 1, z), signRow(y + 1, z + 1),
+                        bx * BRICK_SIZE, min(run_end * BRICK_SIZE, grid.nx - 1), slab.row_active.data(), slab.cubes.data());
+                    bx = run_end;
+
+                    for (int i = 0; i < found; i++) {
+                        int x = slab.row_active[i];
+                        int idx = slab.cubes[i];
+
+                        ActiveCell cell;
+                        cell.x = x;
+                        cell.y = y;
+                        cell.z = z;
+                        cell.cube = idx;
+                        slab.active.push_back(cell);
+
+                        slab.vert_count += bit_count(edgeTable[idx] & owned_edges(x, y, z));
+                        slab.elem_count += counts.tris[idx] * 3;
+                    }
+                }
+            }
+        }
+    }
+
+    // Whether the slab's active cells may differ from the previous extraction: either
+    // its set of active bricks or the sign bits of its samples changed
+    template <typename Scalar>
+    bool BasicExtractor<Scalar>::slabChanged(const Slab& slab) {
+        for (int z = slab.z_begin; z <= slab.z_end; z++) {
+            if (signs_changed[z]) {
+                return true;
+            }
+        }
+
+        int row_words = bricks.rowWords();
+        for (int bz = slab.z_begin / BRICK_SIZE; bz <= (slab.z_end - 1) / BRICK_SIZE; bz++) {
+            const uint64_t* rows = brickRow(active_bricks, 0, bz);
+            const uint64_t* previous = brickRow(previous_bricks, 0, bz);
+            for (int w = 0; w < bricks.bricksY() * row_words; w++) {
+                if (rows[w] != previous[w]) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Second pass: writes the slab's vertices and indices straight into its ranges of mesh
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::emitSlab(Slab& slab, Mesh& mesh) {
+        size_t slice_cells = (size_t)(grid.nx - 1) * (grid.ny - 1);
+        slab.v1.resize(slice_cells);
+        slab.v2.resize(slice_cells);
+        slab.current_vox = &slab.v1;
+        slab.prev_vox = &slab.v2;
+        slab.seams.clear();
+
+        int next_vert = 0;
+        size_t next_elem = 0;
+        int z = -1;
+
+        for (size_t c = 0; c < slab.active.size(); c++) {
+            const ActiveCell& cell = slab.active[c];
+            // Cells of an empty slice never share edges with crossing cells,
+            // so one swap per change of slice is enough
+            if (cell.z != z) {
+                swapSlices(slab);
+                z = cell.z;
+            }
+
+            int idx = cell.cube;
+            Voxel vox = get_voxel(cell.x, cell.y, cell.z);
+
+            int edges = edgeTable[idx];
+            for (int e = 0; e < EDGE_VERTS; e++) {
+                if (!(edges & (1 << e))) {
+                    continue;
+                }
+
+                int elem = getVertIdx(slab, cell.x, cell.y, cell.z, e);
+                if (elem == NO_VERT) {
+                    int i1 = interp_table[e][0];
+                    int i2 = interp_table[e][1];
+                    vec3 vert[2];
+                    interpolate(vox.verts[i1], vox.verts[i2], vert);
+                    elem = next_vert++;
+                    mesh.verts[slab.vert_base + elem] = vert[0];
+                    mesh.norms[slab.vert_base + elem] = vert[1];
+                }
+                vox.edges[e] = elem;
+            }
+
+            for (int i = 0; triTable[idx][i] != -1; i++) {
+                int elem = vox.edges[triTable[idx][i]];
+                if (elem < NO_VERT) {
+                    Seam seam;
+                    seam.elem = next_elem;
+                    seam.ref = -2 - elem;
+                    slab.seams.push_back(seam);
+                }
+                else {
+                    mesh.elements[slab.elem_base + next_elem] = (unsigned int)(slab.vert_base + elem);
+                }
+                next_elem++;
+            }
+            sliceVoxel(*slab.current_vox, cell.x, cell.y) = vox;
+        }
+
+        if ((size_t)next_vert != slab.vert_count || next_elem != slab.elem_count) {
+            throw logic_error("Emitted mesh does not match the counting pass");
+        }
+    }
+
+    // Rewrites the vertices of a slab whose cells did not change, in the order emitSlab
+    // created them, and moves its indices when its offsets changed. Indices into the
+    // slab below are left to resolveSeams.
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::refreshSlab(Slab& slab, Mesh& mesh) {
+        if (slabMoved(slab)) {
+            unsigned int* elements = &mesh.elements[slab.elem_base];
+            for (size_t i = 0; i < slab.elem_count; i++) {
+                elements[i] = (unsigned int)(slab.moved_elements[i] + slab.vert_base);
+            }
+        }
+
+        size_t next_vert = slab.vert_base;
+
+        for (size_t c = 0; c < slab.active.size(); c++) {
+            const ActiveCell& cell = slab.active[c];
+            Voxel vox = get_voxel(cell.x, cell.y, cell.z);
+
+            int edges = edgeTable[cell.cube] & owned_edges(cell.x, cell.y, cell.z);
+            for (int e = 0; e < EDGE_VERTS; e++) {
+                if (!(edges & (1 << e))) {
+                    continue;
+                }
+
+                vec3 vert[2];
+                interpolate(vox.verts[interp_table[e][0]], vox.verts[interp_table[e][1]], vert);
+                mesh.verts[next_vert] = vert[0];
+                mesh.norms[next_vert] = vert[1];
+                next_vert++;
+            }
+        }
+    }
+
+    template <typename Scalar>
+    bool BasicExtractor<Scalar>::slabMoved(const Slab& slab) {
+        return slab.vert_base != slab.previous_vert_base || slab.elem_base != slab.previous_elem_base;
+    }
+
+    // Copies the indices of a slab that keeps its cells but moves out of the previous
+    // mesh before it is resized, numbered from the slab's first vertex
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::saveMoved(Slab& slab, const Mesh& mesh) {
+        slab.moved_elements.resize(slab.elem_count);
+        const unsigned int* elements = &mesh.elements[slab.previous_elem_base];
+        for (size_t i = 0; i < slab.elem_count; i++) {
+            slab.moved_elements[i] = (unsigned int)(elements[i] - slab.previous_vert_base);
+        }
+    }
+
+    // Points the seam indices of slab k at the vertices emitted by the last slice of
+    // slab k - 1, which may have been emitted again or moved since slab k was emitted
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::resolveSeams(int k, Mesh& mesh) {
+        Slab& slab = slabs[k];
+        Slab& below = slabs[k - 1];
+        for (size_t i = 0; i < slab.seams.size(); i++) {
+            int ref = slab.seams[i].ref;
+            // The last slice emitted is still current, and it is the slab's top slice
+            // whenever the seam is crossed
+            int elem = (*below.current_vox)[ref / EDGE_VERTS].edges[ref % EDGE_VERTS];
+            mesh.elements[slab.elem_base + slab.seams[i].elem] = (unsigned int)(below.vert_base + elem);
+        }
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::computeTris(Mesh& mesh, bool incremental) {
+        int cell_slices = grid.nz - 1;
+        int slab_count = pool ? min(cell_slices, pool->size() * SLABS_PER_THREAD) : 1;
+
+        // Patching needs the slabs of the previous extraction and its untouched output
+        if (incremental) {
+            incremental = extracted && (int)slabs.size() == slab_count && mesh.generation == extracted_generation &&
+                mesh.verts.size() == slabs.back().vert_base + slabs.back().vert_count &&
+                mesh.norms.size() == mesh.verts.size() &&
+                mesh.elements.size() == slabs.back().elem_base + slabs.back().elem_count;
+        }
+        extracted = false;
+        // A mesh left half written by an exception is never patched
+        mesh.generation = 0;
+
+        slabs.resize(slab_count);
+        for (int k = 0; k < slab_count; k++) {
+            slabs[k].z_begin = (int)((long long)cell_slices * k / slab_count);
+            slabs[k].z_end = (int)((long long)cell_slices * (k + 1) / slab_count);
+        }
+
+        // Only bricks whose range straddles the isovalue are visited from here on
+        if (incremental) {
+            previous_bricks.swap(active_bricks);
+        }
+        bricks.findActive(isovalue, active_bricks);
+
+        // Pre-pass: one sign bit per sample, so the classification sweep only streams
+        // the bitset and the full samples are read again for crossed cells only.
+        // When patching, the bits of the previous extraction are still right outside
+        // the bricks that may hold a sample in [lo, hi), so only those are repacked.
+        sign_row_words = sign_words(grid.nx);
+        signs.resize((size_t)sign_row_words * grid.ny * grid.nz);
+        const vector<uint64_t>* pack_mask = &active_bricks;
+        if (incremental) {
+            float lo = min(isovalue, extracted_isovalue);
+            float hi = max(isovalue, extracted_isovalue);
+            bricks.findOverlapping(lo, hi, changed_bricks);
+            pack_mask = &changed_bricks;
+        }
+        signs_changed.resize(grid.nz);
+        parallel_for(pool, grid.nz, [this, pack_mask](int z) {
+            signs_changed[z] = packSigns(z, *pack_mask);
+        });
+
+        for (int k = 0; k < slab_count; k++) {
+            slabs[k].same_cells = incremental && !slabChanged(slabs[k]);
+        }
+        parallel_for(pool, slab_count, [this](int k) {
+            if (!slabs[k].same_cells) {
+                classifySlab(slabs[k]);
+            }
+        });
+
+        // Prefix sums give every slab its offset in the output buffers
+        size_t vert_count = 0;
+        size_t elem_count = 0;
+        for (int k = 0; k < slab_count; k++) {
+            Slab& slab = slabs[k];
+            slab.previous_vert_base = slab.vert_base;
+            slab.previous_elem_base = slab.elem_base;
+            slab.vert_base = vert_count;
+            slab.elem_base = elem_count;
+            vert_count += slab.vert_count;
+            elem_count += slab.elem_count;
+        }
+        if (vert_count > (size_t)INT_MAX) {
+            throw overflow_error("Mesh has too many vertices for 32-bit indices");
+        }
+
+        // Slabs that keep their cells but move take their indices out of the previous
+        // mesh first, as the ranges of other slabs may now overlap them
+        parallel_for(pool, slab_count, [this, &mesh](int k) {
+            if (slabs[k].same_cells && slabMoved(slabs[k])) {
+                saveMoved(slabs[k], mesh);
+            }
+        });
+
+        // Sized exactly once, existing capacity is reused between extractions
+        mesh.verts.resize(vert_count);
+        mesh.norms.resize(vert_count);
+        mesh.elements.resize(elem_count);
+
+        parallel_for(pool, slab_count, [this, &mesh](int k) {
+            if (slabs[k].same_cells) {
+                refreshSlab(slabs[k], mesh);
+            }
+            else {
+                emitSlab(slabs[k], mesh);
+            }
+        });
+
+        parallel_for(pool, slab_count - 1, [this, &mesh](int k) {
+            resolveSeams(k + 1, mesh);
+        });
+
+        extracted = true;
+        extracted_isovalue = isovalue;
+        extracted_generation = mesh.generation = next_generation();
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::setGradientMode(GradientMode mode) {
+        if (mode != gradient_mode) {
+            gradient_mode = mode;
+            field_valid = false;
+        }
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::setLazyGradients(bool lazy) {
+        if (lazy != lazy_gradients) {
+            lazy_gradients = lazy;
+            field_valid = false;
+        }
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::sampleField(const Field& field, const Grid& grid) {
+        if (grid.nx < 2 || grid.ny < 2 || grid.nz < 2) {
+            throw invalid_argument("Grid needs at least 2 samples along each axis");
+        }
+        if (grid.spacing.x <= 0 || grid.spacing.y <= 0 || grid.spacing.z <= 0) {
+            throw invalid_argument("Grid spacing must be positive");
+        }
+        if (field_valid && &field == this->field && grid == this->grid) {
+            return;
+        }
+
+        this->field = &field;
+        this->grid = grid;
+
+        values.resize(grid.samples());
+        freeGradientBlocks();
+        if (lazy_gradients) {
+            gradients = vector<Gradient>();
+            gradient_blocks_x = (grid.nx + BRICK_SIZE - 1) / BRICK_SIZE;
+            gradient_blocks_y = (grid.ny + BRICK_SIZE - 1) / BRICK_SIZE;
+            int blocks_z = (grid.nz + BRICK_SIZE - 1) / BRICK_SIZE;
+            gradient_blocks = vector<atomic<GradientBlock*> >((size_t)gradient_blocks_x * gradient_blocks_y * blocks_z);
+        }
+        else {
+            gradients.resize(grid.samples());
+        }
+        computeValues();
+        computeBricks();
+        field_valid = true;
+        extracted = false;
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::sampleField(Function function, const Grid& grid) {
+        sampleField(builtin_field(function), grid);
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::invalidateField() {
+        field_valid = false;
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::extract(float isovalue, Mesh& mesh) {
+        if (!field_valid) {
+            throw logic_error("extract called before sampleField");
+        }
+
+        this->isovalue = isovalue;
+
+        computeTris(mesh, false);
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::update(float isovalue, Mesh& mesh) {
+        if (!field_valid) {
+            throw logic_error("update called before sampleField");
+        }
+
+        this->isovalue = isovalue;
+
+        computeTris(mesh, true);
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::march(const Field& field, const Grid& grid, float isovalue, Mesh& mesh) {
+        sampleField(field, grid);
+        extract(isovalue, mesh);
+    }
+
+    template <typename Scalar>
+    void BasicExtractor<Scalar>::march(Function function, const Grid& grid, float isovalue, Mesh& mesh) {
+        march(builtin_field(function), grid, isovalue, mesh);
+    }
+
+    template class BasicExtractor<float>;
+    template class BasicExtractor<Half>;
+
+    MeshSink::~MeshSink() {
+    }
+
+    StreamingExtractor::StreamingExtractor(ThreadPool* pool) :
+        field(NULL),
+        isovalue(0),
+        gradient_mode(GRADIENT_FUNCTION),
+        pool(pool),
+        sign_row_words(0),
+        run_cells(STREAM_RUN),
+        run_offset(0),
+        current_edges(&v1),
+        prev_edges(&v2),
+        vertex_count(0)
+    {
+    }
+
+    void StreamingExtractor::setGradientMode(GradientMode mode) {
+        gradient_mode = mode;
+    }
+
+    StreamingExtractor::Slice& StreamingExtractor::slice(int z) {
+        return ring[z % ring.size()];
+    }
+
+    const uint64_t* StreamingExtractor::signRow(int y, int z) {
+        return &slice(z).signs[(size_t)y * sign_row_words];
+    }
+
+    float StreamingExtractor::valueAt(pt3 pt) {
+        return slice(pt.z).values[(size_t)pt.y * grid.nx + pt.x];
+    }
+
+    bool StreamingExtractor::sampledAt(pt3 pt) {
+        return (slice(pt.z).sampled[(size_t)pt.y * sign_row_words + (pt.x >> 6)] >> (pt.x & 63)) & 1;
+    }
+
+    vec3 StreamingExtractor::normalAt(pt3 pt) {
+        if (gradient_mode == GRADIENT_FUNCTION) {
+            vec3 p = grid.position(pt.x, pt.y, pt.z);
+            return field->gradient(p.x, p.y, p.z, grid.spacing);
+        }
+
+        // The ring still holds the slices on both sides of every sample the current
+        // cell slice reads. Samples bounded away from the isovalue hold a stand-in value,
+        // but every endpoint of a crossing edge has a sampled neighbour along each axis.
+        auto value = [this](int x, int y, int z) {
+            return valueAt(pt3(x, y, z));
+        };
+        auto known = [this](int x, int y, int z) {
+            return sampledAt(pt3(x, y, z));
+        };
+        const vec3& h = grid.spacing;
+        return vec3(
+            sample_difference(grid, value, known, pt.x, pt.y, pt.z, 1, 0, 0) / h.x,
+            sample_difference(grid, value, known, pt.x, pt.y, pt.z, 0, 1, 0) / h.y,
+            sample_difference(grid, value, known, pt.x, pt.y, pt.z, 0, 0, 1) / h.z);
+    }
+
+    // Same sharing as BasicExtractor::getVertIdx, without slab seams
+    int StreamingExtractor::getVertIdx(int x, int y, int z, int e) {
+        size_t row = grid.nx - 1;
+        int elem = NO_VERT;
+        if (y > 0 && y_neighbor_edge[e] >= 0) {
+            elem = (*current_edges)[(y - 1) * row + x].edges[y_neighbor_edge[e]];
+        }
+        if (elem == NO_VERT && x > 0 && x_neighbor_edge[e] >= 0) {
+            elem = (*current_edges)[y * row + x - 1].edges[x_neighbor_edge[e]];
+        }
+        if (elem == NO_VERT && z > 0 && z_neighbor_edge[e] >= 0) {
+            elem = (*prev_edges)[y * row + x].edges[z_neighbor_edge[e]];
+        }
+        return elem;
+    }
+
+    // Cells per block along an axis of a grid and the first cell of a block, when blocks
+    // at block_origin of block_size line up with the cells
+    static bool block_cells(float block_origin, float block_size, float origin, float spacing, int& cells, int& offset) {
+        float size = block_size / spacing;
+        float corner = (block_origin - origin) / spacing;
+        cells = (int)floor(size + .5f);
+        int first = (int)floor(corner + .5f);
+        if (cells < 1 || abs(size - cells) > BLOCK_TOLERANCE || abs(corner - first) > BLOCK_TOLERANCE) {
+            return false;
+        }
+        offset = (first % cells + cells) % cells;
+        return true;
+    }
+
+    // End of the run of cells starting at cell x
+    int StreamingExtractor::runEnd(int x) {
+        int into = ((x - run_offset) % run_cells + run_cells) % run_cells;
+        return min(x + run_cells - into, grid.nx - 1);
+    }
+
+    // Whether the field bounds cells [x_begin, x_end) of the cell rows and slices next to
+    // sample row y of slice z away from the isovalue. If so, value gets a value on their
+    // side. The box spans just those cells, so for a run within one block along x it
+    // covers no block beside it.
+    bool StreamingExtractor::boundedAway(int x_begin, int x_end, int y, int z, float& value) {
+        vec3 lo = grid.position(x_begin, max(y - 1, 0), max(z - 1, 0));
+        vec3 hi = grid.position(x_end, min(y + 1, grid.ny - 1), min(z + 1, grid.nz - 1));
+        BrickPyramid::Range range;
+        if (!field->bounds(lo, hi, range.min, range.max) || straddles(range, isovalue)) {
+            return false;
+        }
+        value = range.min;
+        return true;
+    }
+
+    // Samples [x_begin, x_end] of row y in slice z from the field
+    void StreamingExtractor::sampleSpan(int x_begin, int x_end, int y, int z) {
+        Slice& s = slice(z);
+        vec3 start = grid.position(x_begin, y, z);
+        field->valueRow(start.x, start.y, start.z, grid.spacing.x, x_end - x_begin + 1, &s.values[(size_t)y * grid.nx + x_begin]);
+        uint64_t* bits = &s.sampled[(size_t)y * sign_row_words];
+        for (int x = x_begin; x <= x_end; x++) {
+            bits[x >> 6] |= 1ull << (x & 63);
+        }
+    }
+
+    // Samples rows [y_begin, y_end) of slice z into its ring slot and packs their signs.
+    // Where the field bounds every cell next to a run of samples away from the isovalue,
+    // no crossing cell reads the run, so it is filled with a value on the right side
+    // instead of sampled. A sample on the face between a bounded run and one that is not
+    // belongs to a crossing cell and is sampled with the run that needs it.
+    void StreamingExtractor::sampleRows(int z, int y_begin, int y_end) {
+        Slice& s = slice(z);
+
+        for (int y = y_begin; y < y_end; y++) {
+            float* row = &s.values[(size_t)y * grid.nx];
+            uint64_t* sampled = &s.sampled[(size_t)y * sign_row_words];
+            fill(sampled, sampled + sign_row_words, 0);
+            float side;
+
+            // One query for the whole row first, most fields have no bounds
+            if (!field->bounds(grid.position(0, max(y - 1, 0), max(z - 1, 0)),
+                    grid.position(grid.nx - 1, min(y + 1, grid.ny - 1), min(z + 1, grid.nz - 1)), side, side)) {
+                sampleSpan(0, grid.nx - 1, y, z);
+            }
+            else {
+                // Consecutive runs that need sampling go to the field together, with the
+                // far face of the last one
+                int first = -1;
+                int x = 0;
+                while (x < grid.nx - 1) {
+                    int end = runEnd(x);
+                    if (!boundedAway(x, end, y, z, side)) {
+                        if (first < 0) {
+                            first = x;
+                        }
+                    }
+                    else {
+                        fill(row + x, row + (end == grid.nx - 1 ? grid.nx : end), side);
+                        if (first >= 0) {
+                            sampleSpan(first, x, y, z);
+                            first = -1;
+                        }
+                    }
+                    x = end;
+                }
+                if (first >= 0) {
+                    sampleSpan(first, grid.nx - 1, y, z);
+                }
+            }
+
+            uint64_t* bits = &s.signs[(size_t)y * sign_row_words];
+            for (int w = 0; w < sign_row_words; w++) {
+                bits[w] = sign_word(row + w * 64, min(64, grid.nx - w * 64), isovalue);
+            }
+        }
+    }
+
+    // Classifies and emits the cells between sample slices z and z + 1 into chunk
+    void StreamingExtractor::extractSlice(int z, Mesh& chunk) {
+        chunk.verts.clear();
+        chunk.norms.clear();
+        chunk.elements.clear();
+
+        vector<CellEdges>* c = current_edges;
+        current_edges = prev_edges;
+        prev_edges = c;
+
+        for (int y = 0; y < grid.ny - 1; y++) {
+            int found = classify_cells(signRow(y, z), signRow(y, z + 1), signRow(y + 1, z), signRow(y + 1, z + 1),
+                0, grid.nx - 1, row_active.data(), cubes.data());
+
+            for (int i = 0; i < found; i++) {
+                int x = row_active[i];
+                int idx = cubes[i];
+                Voxel vox = get_voxel(x, y, z);
+
+                int edges = edgeTable[idx];
+                for (int e = 0; e < EDGE_VERTS; e++) {
+                    if (!(edges & (1 << e))) {
+                        continue;
+                    }
+
+                    int elem = getVertIdx(x, y, z, e);
+                    if (elem == NO_VERT) {
+                        if (vertex_count >= (size_t)INT_MAX) {
+                            throw overflow_error("Mesh has too many vertices for 32-bit indices");
+                        }
+                        pt3 p1 = vox.verts[interp_table[e][0]];
+                        pt3 p2 = vox.verts[interp_table[e][1]];
+                        vec3 vert[2];
+                        interpolate_edge(grid, isovalue, p1, p2, valueAt(p1), valueAt(p2), normalAt(p1), normalAt(p2), vert);
+                        elem = (int)vertex_count++;
+                        chunk.verts.push_back(vert[0]);
+                        chunk.norms.push_back(vert[1]);
+                    }
+                    vox.edges[e] = elem;
+                }
+
+                for (int n = 0; triTable[idx][n] != -1; n++) {
+                    chunk.elements.push_back(vox.edges[triTable[idx][n]]);
+                }
+                copy(vox.edges, vox.edges + EDGE_VERTS, (*current_edges)[(size_t)y * (grid.nx - 1) + x].edges);
+            }
+        }
+    }
+
+    void StreamingExtractor::march(const Field& field, const Grid& grid, float isovalue, MeshSink& sink) {
+        if (grid.nx < 2 || grid.ny < 2 || grid.nz < 2) {
+            throw invalid_argument("Grid needs at least 2 samples along each axis");
+        }
+        if (grid.spacing.x <= 0 || grid.spacing.y <= 0 || grid.spacing.z <= 0) {
+            throw invalid_argument("Grid spacing must be positive");
+        }
+
+        this->field = &field;
+        this->grid = grid;
+        this->isovalue = isovalue;
+
+        // Cell slice z reads sample slices z - 1 to z + 2 while slice z + 3 is sampled
+        sign_row_words = sign_words(grid.nx);
+        ring.resize(STREAM_SLICES);
+        for (size_t i = 0; i < ring.size(); i++) {
+            ring[i].values.resize((size_t)grid.nx * grid.ny);
+            ring[i].signs.resize((size_t)sign_row_words * grid.ny);
+            ring[i].sampled.resize((size_t)sign_row_words * grid.ny);
+        }
+        size_t slice_cells = (size_t)(grid.nx - 1) * (grid.ny - 1);
+        v1.resize(slice_cells);
+        v2.resize(slice_cells);
+        row_active.resize(grid.nx - 1);
+        cubes.resize(grid.nx - 1);
+        vertex_count = 0;
+
+        // Bounds are queried a block at a time along x where the field's blocks line up
+        // with the cells, and the row chunks below end on block faces
+        vec3 block_origin, block_size;
+        bool blocks = field.boundsBlocks(block_origin, block_size);
+        int block_rows = 0, block_row_offset = 0;
+        if (!blocks || !block_cells(block_origin.x, block_size.x, grid.origin.x, grid.spacing.x, run_cells, run_offset)) {
+            run_cells = STREAM_RUN;
+            run_offset = 0;
+        }
+        if (blocks && !block_cells(block_origin.y, block_size.y, grid.origin.y, grid.spacing.y, block_rows, block_row_offset)) {
+            block_rows = 0;
+        }
+
+        // Every slice is sampled in row chunks, one per thread. Against blocks, a chunk
+        // starts after a block face, so the rows of a block up to its far face are sampled
+        // in order by one thread and a face is read after the block below it.
+        vector<int> chunk_begin(1, 0);
+        int threads = pool ? min(pool->size(), grid.ny) : 1;
+        for (int c = 1; c < threads; c++) {
+            int begin = (int)((long long)grid.ny * c / threads);
+            if (block_rows > 0) {
+                begin = (int)floor((begin - 1 - block_row_offset) / (float)block_rows + .5f) * block_rows + block_row_offset + 1;
+            }
+            if (begin > chunk_begin.back() && begin < grid.ny) {
+                chunk_begin.push_back(begin);
+            }
+        }
+        chunk_begin.push_back(grid.ny);
+        int chunk_rows = (int)chunk_begin.size() - 1;
+        auto sample_chunk = [this, &chunk_begin](int z, int c) {
+            sampleRows(z, chunk_begin[c], chunk_begin[c + 1]);
+        };
+
+        int lookahead = STREAM_SLICES - 2;
+        for (int z = 0; z < min(lookahead, grid.nz); z++) {
+            parallel_for(pool, chunk_rows, [&sample_chunk, z](int c) {
+                sample_chunk(z, c);
+            });
+        }
+
+        // Step z extracts cell slice z, samples slice z + lookahead into the ring slot of
+        // sample slice z - 2 and hands the chunk of cell slice z - 1 to the sink. The
+        // stages of a step touch disjoint buffers, and each step waits for the last one,
+        // which keeps the sampler at most lookahead slices ahead of extraction.
+        int cell_slices = grid.nz - 1;
+        size_t delivered = 0;
+        for (int z = 0; z <= cell_slices; z++) {
+            int next = z + lookahead;
+            int samplers = next < grid.nz ? chunk_rows : 0;
+            parallel_for(pool, 2 + samplers, [&, z, next](int i) {
+                if (i == 0) {
+                    if (z < cell_slices) {
+                        extractSlice(z, chunks[z % 2]);
+                    }
+                }
+                else if (i == 1) {
+                    if (z > 0) {
+                        const Mesh& chunk = chunks[(z - 1) % 2];
+                        sink.consume(chunk, delivered);
+                        delivered += chunk.verts.size();
+                    }
+                }
+                else {
+                    sample_chunk(next, i - 2);
+                }
+            });
+        }
+    }
+
+    // Collects the chunks of a streaming extraction into one mesh
+    class MeshCollector : public MeshSink {
+    public:
+        MeshCollector(Mesh& mesh) :
+            mesh(mesh)
+        {
+            mesh.verts.clear();
+            mesh.norms.clear();
+            mesh.elements.clear();
+            mesh.generation = 0;
+        }
+
+        void consume(const Mesh& chunk, size_t) {
+            mesh.verts.insert(mesh.verts.end(), chunk.verts.begin(), chunk.verts.end());
+            mesh.norms.insert(mesh.norms.end(), chunk.norms.begin(), chunk.norms.end());
+            mesh.elements.insert(mesh.elements.end(), chunk.elements.begin(), chunk.elements.end());
+        }
+
+    private:
+        Mesh& mesh;
+    };
+
+    void StreamingExtractor::march(const Field& field, const Grid& grid, float isovalue, Mesh& mesh) {
+        MeshCollector collector(mesh);
+        march(field, grid, isovalue, collector);
+    }
+
+    void StreamingExtractor::march(Function function, const Grid& grid, float isovalue, Mesh& mesh) {
+        march(builtin_field(function), grid, isovalue, mesh);
+    }
+
+    void march(Function function, const Grid& grid, float isovalue, Mesh& mesh) {
+        Extractor extractor;
+        extractor.march(function, grid, isovalue, mesh);
+    }
+}
@@ -0,0 +1,360 @@
+#pragma once
+#ifndef _MarchingCubes_H_
+#define _MarchingCubes_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "BrickPyramid.h"
+#include "Field.h"
+#include "Half.h"
+#include "ThreadPool.h"
+
+namespace mc {
+
+    // How sample gradients, and so the mesh normals, are computed
+    enum GradientMode {
+        // Gradient supplied by the field, analytic for the built-in functions
+        GRADIENT_FUNCTION,
+        // Central differences of the neighboring samples, no extra evaluations
+        GRADIENT_SAMPLES
+    };
+
+    // Regular sampling lattice of nx * ny * nz points, the first at origin and the
+    // rest spacing apart along each axis
+    struct Grid {
+        int nx, ny, nz;
+        glm::vec3 origin;
+        glm::vec3 spacing;
+
+        Grid();
+        Grid(int nx, int ny, int nz, glm::vec3 origin, glm::vec3 spacing);
+
+        // grid_size^3 unit lattice centered on the world origin
+        static Grid centered(int grid_size);
+
+        size_t samples() const;
+        glm::vec3 position(int x, int y, int z) const;
+
+        bool operator==(const Grid& other) const;
+        bool operator!=(const Grid& other) const;
+    };
+
+    // Triangle mesh produced by an extraction, laid out as vertex/normal/index buffers
+    struct Mesh {
+        std::vector<glm::vec3> verts;
+        std::vector<glm::vec3> norms;
+        std::vector<unsigned int> elements;
+        // Identifies the extraction that wrote the buffers, 0 for none. Copies keep it,
+        // so code that edits the buffers must reset it.
+        uint64_t generation;
+
+        Mesh() : generation(0) {}
+    };
+
+    // Sample indices along the grid axes
+    struct pt3 {
+        int x, y, z;
+        pt3() {}
+        pt3(int _x, int _y, int _z) : x(_x), y(_y), z(_z) {}
+    };
+
+    // Corner coordinates of a cell and the mesh vertex emitted on each of its edges, or -1
+    struct Voxel {
+        pt3 verts[8];
+        int edges[12];
+    };
+
+    // Owns the sampled field, slice caches and output of one extraction at a time.
+    // Separate instances share no state and can run concurrently on different threads.
+    // Samples are stored as Scalar, float or Half, and all arithmetic is done in float.
+    template <typename Scalar>
+    class BasicExtractor {
+    public:
+        // Work is split across pool when one is given, the pool may be shared by several extractors
+        BasicExtractor(ThreadPool* pool = NULL);
+        ~BasicExtractor();
+
+        // Defaults to GRADIENT_FUNCTION, changing it discards the sampled field
+        void setGradientMode(GradientMode mode);
+        // When set, gradients are computed the first time a crossing edge needs them and
+        // kept for later extractions, instead of for every sample by sampleField. They are
+        // stored per BRICK_SIZE^3 block of samples, allocated when a gradient of the block
+        // is first needed, so memory follows the surface rather than the grid.
+        // Defaults to false, changing it discards the sampled field.
+        void setLazyGradients(bool lazy);
+
+        // Samples field over grid. The sampled field is kept, so this does nothing if the
+        // same field object and grid are already sampled. field must outlive the extractor,
+        // or at least its next sampleField, and invalidateField must be called if it changes.
+        void sampleField(const Field& field, const Grid& grid);
+        // Samples a built-in function
+        void sampleField(Function function, const Grid& grid);
+        // Forces the next sampleField to resample
+        void invalidateField();
+        // Replaces the contents of mesh with the isosurface of the sampled field at isovalue
+        void extract(float isovalue, Mesh& mesh);
+        // Same result as extract, but mesh must hold the unmodified output of the last
+        // extract or update of this extractor, or a copy of it. Only bricks where samples
+        // changed sides since then are repacked, and only the slabs holding such samples
+        // are classified and emitted again, a slab being the cell slices one pool task
+        // extracts, or all of them without a pool. The other slabs keep their triangles,
+        // shifted to their new offsets, and only have their vertices moved. Every vertex
+        // is still interpolated again, so an update costs about as much as extract where
+        // the surface changes in every slab, and about half where it changes in few.
+        // Falls back to a full extraction when the field changed or mesh.generation is
+        // not that of the last extraction.
+        void update(float isovalue, Mesh& mesh);
+
+        // sampleField followed by extract
+        void march(const Field& field, const Grid& grid, float isovalue, Mesh& mesh);
+        void march(Function function, const Grid& grid, float isovalue, Mesh& mesh);
+
+    private:
+        const Field* field;
+        float isovalue;
+        Grid grid;
+        GradientMode gradient_mode;
+        bool lazy_gradients;
+        bool field_valid;
+        // Slabs, masks and sign bits describe an extraction of the current field
+        bool extracted;
+        float extracted_isovalue;
+        // Mesh generation the last extraction wrote
+        uint64_t extracted_generation;
+
+        ThreadPool* pool;
+
+        // Cell crossed by the surface and its cube case
+        struct ActiveCell {
+            int x, y, z;
+            int cube;
+        };
+
+        // Index of the slab's first slice that references edge ref % 12 of cell ref / 12
+        // in the last slice of the slab below
+        struct Seam {
+            size_t elem;
+            int ref;
+        };
+
+        // Range of cell slices [z_begin, z_end) extracted by one task. A counting pass
+        // finds the slab's active cells and output sizes, then an emitting pass writes
+        // them to the slab's ranges of the mesh. Vertices on the slab's bottom face
+        // belong to the slab below and are referenced through its last slice until
+        // the seams are resolved. Voxel slices count vertices from the slab's first one.
+        struct Slab {
+            int z_begin, z_end;
+
+            std::vector<ActiveCell> active;
+            std::vector<int> row_active;
+            std::vector<uint8_t> cubes;
+            size_t vert_count;
+            size_t elem_count;
+            std::vector<Seam> seams;
+
+            size_t vert_base;
+            size_t elem_base;
+
+            // Active cells were carried over from the previous extraction, so only the
+            // vertices are rewritten
+            bool same_cells;
+            // Offsets of the previous extraction, with same_cells the indices are moved
+            // from them when they changed
+            size_t previous_vert_base;
+            size_t previous_elem_base;
+            std::vector<unsigned int> moved_elements;
+
+            std::vector<Voxel> v1;
+            std::vector<Voxel> v2;
+            std::vector<Voxel>* current_vox;
+            std::vector<Voxel>* prev_vox;
+        };
+
+        std::vector<Slab> slabs;
+
+        // Gradient of one sample, stored as Scalar like the values
+        struct Gradient {
+            Scalar x, y, z;
+
+            Gradient() {}
+            Gradient(const glm::vec3& g) : x(g.x), y(g.y), z(g.z) {}
+            operator glm::vec3() const { return glm::vec3(x, y, z); }
+        };
+
+        // Sampled field, values and gradients in separate arrays so the sweeps that
+        // only compare values against the isovalue do not pull gradients into the cache
+        std::vector<Scalar> values;
+        std::vector<Gradient> gradients;
+
+        // Gradients of a block of samples, with lazy gradients, and whether each is
+        // missing, being written or ready
+        struct GradientBlock {
+            Gradient gradients[BRICK_SIZE * BRICK_SIZE * BRICK_SIZE];
+            std::atomic<uint8_t> state[BRICK_SIZE * BRICK_SIZE * BRICK_SIZE];
+
+            GradientBlock();
+        };
+
+        // One per block of samples along x, then y, then z, NULL until first needed
+        std::vector<std::atomic<GradientBlock*> > gradient_blocks;
+        int gradient_blocks_x;
+        int gradient_blocks_y;
+
+        // Value ranges of the sampled field, built with it
+        BrickPyramid bricks;
+        // Bricks straddling the current isovalue, one bit per brick along x
+        std::vector<uint64_t> active_bricks;
+        // Bricks straddling the previous isovalue, kept while patching
+        std::vector<uint64_t> previous_bricks;
+        // Bricks that may hold samples that changed sides since the previous extraction
+        std::vector<uint64_t> changed_bricks;
+
+        // One bit per sample, set below the isovalue, rows padded to whole words
+        std::vector<uint64_t> signs;
+        int sign_row_words;
+        // Slices where repacking changed any sign bits
+        std::vector<uint8_t> signs_changed;
+
+        size_t sampleIndex(int x, int y, int z);
+        Scalar& sampleValue(int x, int y, int z);
+        Gradient& sampleGradient(int x, int y, int z);
+        GradientBlock& gradientBlock(int x, int y, int z);
+        void freeGradientBlocks();
+        Voxel& sliceVoxel(std::vector<Voxel>& slice, int x, int y);
+        float valueAt(pt3 pt);
+        glm::vec3 normalAt(pt3 pt);
+        glm::vec3* interpolate(pt3 p1, pt3 p2, glm::vec3* ret);
+        int getVertIdx(Slab& slab, int x, int y, int z, int e);
+        void swapSlices(Slab& slab);
+
+        void sampleSlice(int z);
+        float sampleDifference(int x, int y, int z, int dx, int dy, int dz);
+        glm::vec3 functionGradient(int x, int y, int z);
+        glm::vec3 differenceGradient(int x, int y, int z);
+        void differenceSlice(int z);
+        void computeValues();
+        void computeBrickSlice(int bz);
+        void computeBricks();
+        const uint64_t* brickRow(const std::vector<uint64_t>& mask, int by, int bz);
+        bool packSigns(int z, const std::vector<uint64_t>& mask);
+        const uint64_t* signRow(int y, int z);
+        void classifySlab(Slab& slab);
+        bool slabChanged(const Slab& slab);
+        void emitSlab(Slab& slab, Mesh& mesh);
+        void refreshSlab(Slab& slab, Mesh& mesh);
+        bool slabMoved(const Slab& slab);
+        void saveMoved(Slab& slab, const Mesh& mesh);
+        void resolveSeams(int k, Mesh& mesh);
+        void computeTris(Mesh& mesh, bool incremental);
+    };
+
+    typedef BasicExtractor<float> Extractor;
+    // Half the field memory of Extractor, 8 bytes per sample for the value and gradient
+    // against 16, for grids that would not fit otherwise
+    typedef BasicExtractor<Half> HalfExtractor;
+
+    // Receives a mesh a piece at a time as a streaming extraction produces it
+    class MeshSink {
+    public:
+        virtual ~MeshSink();
+
+        // Called once per cell slice, in order and never concurrently, though not always
+        // on the thread that started the extraction. chunk holds the vertices, normals
+        // and triangles the slice added. Indices count from the first vertex of the whole
+        // mesh, first_vertex is the index of chunk's first vertex, and triangles use
+        // vertices of chunk and of the chunk before it only, as a cell slice shares
+        // vertices with the slice below. chunk is reused once consume returns.
+        virtual void consume(const Mesh& chunk, size_t first_vertex) = 0;
+    };
+
+    // Extracts without ever holding the whole sampled field. Runs as a three stage
+    // pipeline over the cell slices: while cell slice z is extracted, the next sample
+    // slices are sampled into a ring of a few slices and the mesh chunk of slice z - 1
+    // goes to the sink. The ring and the two chunks bound how far a stage can run ahead,
+    // so memory grows with nx * ny rather than with the grid, and a slice takes about
+    // as long as its slowest stage. Meant for grids of analytic fields or volumes too
+    // large to sample whole; it gives up the cached sampling and isovalue updates of
+    // Extractor, and skips empty regions only for fields that report bounds.
+    class StreamingExtractor {
+    public:
+        // Work is split across pool when one is given
+        StreamingExtractor(ThreadPool* pool = NULL);
+
+        // Defaults to GRADIENT_FUNCTION
+        void setGradientMode(GradientMode mode);
+
+        // Samples field over grid and passes its isosurface at isovalue to sink a cell
+        // slice at a time. Gradients are computed for the endpoints of crossing edges only,
+        // and samples whose cells the field bounds away from the isovalue are not sampled.
+        // The bounds are queried per block for fields with boundsBlocks, else per run of
+        // cells along x. GRADIENT_SAMPLES takes one-sided differences next to samples that
+        // were not sampled.
+        void march(const Field& field, const Grid& grid, float isovalue, MeshSink& sink);
+        // Same, collecting the chunks into mesh, whose contents are replaced
+        void march(const Field& field, const Grid& grid, float isovalue, Mesh& mesh);
+        void march(Function function, const Grid& grid, float isovalue, Mesh& mesh);
+
+    private:
+        const Field* field;
+        float isovalue;
+        Grid grid;
+        GradientMode gradient_mode;
+
+        ThreadPool* pool;
+
+        // Values and sign bits of one sample slice, slice z is kept in ring[z % ring.size()]
+        struct Slice {
+            std::vector<float> values;
+            // One bit per sample, set below the isovalue, rows padded to whole words
+            std::vector<uint64_t> signs;
+            // Same layout, set for the samples taken from the field rather than bounded
+            std::vector<uint64_t> sampled;
+        };
+
+        std::vector<Slice> ring;
+        int sign_row_words;
+        // Bounds are queried for runs of run_cells cells along x, starting at cells
+        // run_offset + k * run_cells
+        int run_cells;
+        int run_offset;
+
+        // Vertex emitted on each edge of the cells of the current and previous cell slice
+        struct CellEdges {
+            int edges[12];
+        };
+
+        std::vector<CellEdges> v1;
+        std::vector<CellEdges> v2;
+        std::vector<CellEdges>* current_edges;
+        std::vector<CellEdges>* prev_edges;
+        std::vector<int> row_active;
+        std::vector<uint8_t> cubes;
+
+        // Chunk of cell slice z is chunks[z % 2], and vertex_count counts the vertices
+        // of all chunks so far
+        Mesh chunks[2];
+        size_t vertex_count;
+
+        Slice& slice(int z);
+        const uint64_t* signRow(int y, int z);
+        float valueAt(pt3 pt);
+        bool sampledAt(pt3 pt);
+        glm::vec3 normalAt(pt3 pt);
+        int getVertIdx(int x, int y, int z, int e);
+
+        int runEnd(int x);
+        bool boundedAway(int x_begin, int x_end, int y, int z, float& value);
+        void sampleSpan(int x_begin, int x_end, int y, int z);
+        void sampleRows(int z, int y_begin, int y_end);
+        void extractSlice(int z, Mesh& chunk);
+    };
+
+    // Convenience wrapper that runs a one-off extraction on a private Extractor
+    void march(Function function, const Grid& grid, float isovalue, Mesh& mesh);
+}
+
+#endif /* _MarchingCubes_H_ */
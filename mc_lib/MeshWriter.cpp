@@ -0,0 +1,308 @@
+#include "MeshWriter.h"
+
+#include <cstdarg>
+#include <cstring>
+#include <stdexcept>
+
+// Size of the write buffer, a multiple of the usual page and disk block sizes
+#define WRITE_BUFFER_BYTES (1 << 20)
+// Width of the counts patched into file headers
+#define COUNT_DIGITS 20
+#define STL_HEADER_BYTES 80
+
+using namespace glm;
+using namespace std;
+
+namespace mc {
+
+    BufferedFile::BufferedFile() :
+        file(NULL),
+        used(0)
+    {
+    }
+
+    // Best effort only, an unfinished file is incomplete anyway
+    BufferedFile::~BufferedFile() {
+        if (file) {
+            fwrite(buffer.data(), 1, used, file);
+            fclose(file);
+        }
+    }
+
+    void BufferedFile::open(const string& path, const char* mode) {
+        file = fopen(path.c_str(), mode);
+        if (!file) {
+            throw runtime_error("Cannot create " + path);
+        }
+        // The buffer here replaces the stdio one
+        setvbuf(file, NULL, _IONBF, 0);
+        file_path = path;
+        buffer.resize(WRITE_BUFFER_BYTES);
+        used = 0;
+    }
+
+    bool BufferedFile::isOpen() const {
+        return file != NULL;
+    }
+
+    const string& BufferedFile::path() const {
+        return file_path;
+    }
+
+    // Fills the buffer and writes it whole, so every write but the last covers full blocks
+    void BufferedFile::write(const void* data, size_t bytes) {
+        const char* src = (const char*)data;
+        while (bytes > 0) {
+            size_t n = min(bytes, buffer.size() - used);
+            memcpy(&buffer[used], src, n);
+            used += n;
+            src += n;
+            bytes -= n;
+            if (used == buffer.size()) {
+                flush();
+            }
+        }
+    }
+
+    void BufferedFile::writeU8(uint8_t v) {
+        write(&v, 1);
+    }
+
+    void BufferedFile::writeU16(uint16_t v) {
+        uint8_t bytes[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+        write(bytes, 2);
+    }
+
+    void BufferedFile::writeU32(uint32_t v) {
+        uint8_t bytes[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+        write(bytes, 4);
+    }
+
+    void BufferedFile::writeF32(float v) {
+        uint32_t bits;
+        memcpy(&bits, &v, 4);
+        writeU32(bits);
+    }
+
+    void BufferedFile::writeVec3(vec3 v) {
+        writeF32(v.x);
+        writeF32(v.y);
+        writeF32(v.z);
+    }
+
+    void BufferedFile::print(const char* format, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (n < 0 || n >= (int)sizeof(line)) {
+            throw logic_error("Line too long for BufferedFile::print");
+        }
+        write(line, n);
+    }
+
+    void BufferedFile::flush() {
+        if (used > 0 && fwrite(buffer.data(), 1, used, file) != used) {
+            throw runtime_error("Cannot write " + file_path);
+        }
+        used = 0;
+    }
+
+    void BufferedFile::patch(uint64_t offset, const void* data, size_t bytes) {
+        flush();
+        if (fseek(file, (long)offset, SEEK_SET) != 0 || fwrite(data, 1, bytes, file) != bytes || fseek(file, 0, SEEK_END) != 0) {
+            throw runtime_error("Cannot write " + file_path);
+        }
+    }
+
+    void BufferedFile::close() {
+        flush();
+        int failed = fclose(file);
+        file = NULL;
+        if (failed) {
+            throw runtime_error("Cannot write " + file_path);
+        }
+    }
+
+    void BufferedFile::discard() {
+        if (file) {
+            fclose(file);
+            file = NULL;
+        }
+        used = 0;
+    }
+
+    MeshWriter::~MeshWriter() {
+    }
+
+    // Count right-padded with spaces to COUNT_DIGITS, which PLY readers skip as whitespace
+    static string padded_count(uint64_t count) {
+        char text[COUNT_DIGITS + 1];
+        snprintf(text, sizeof(text), "%-*llu", COUNT_DIGITS, (unsigned long long)count);
+        return text;
+    }
+
+    PlyWriter::PlyWriter(const string& path) :
+        vertex_count(0),
+        face_count(0)
+    {
+        out.open(path, "wb");
+        faces.open(path + ".faces", "wb");
+
+        string header =
+            "ply\n"
+            "format binary_little_endian 1.0\n"
+            "element vertex ";
+        vertex_count_offset = header.size();
+        header += padded_count(0) + "\n"
+            "property float x\n"
+            "property float y\n"
+            "property float z\n"
+            "property float nx\n"
+            "property float ny\n"
+            "property float nz\n"
+            "element face ";
+        face_count_offset = header.size();
+        header += padded_count(0) + "\n"
+            "property list uchar int vertex_indices\n"
+            "end_header\n";
+        out.write(header.data(), header.size());
+    }
+
+    PlyWriter::~PlyWriter() {
+        if (faces.isOpen()) {
+            faces.discard();
+            remove(faces.path().c_str());
+        }
+    }
+
+    void PlyWriter::consume(const Mesh& chunk, size_t) {
+        for (size_t i = 0; i < chunk.verts.size(); i++) {
+            out.writeVec3(chunk.verts[i]);
+            out.writeVec3(chunk.norms[i]);
+        }
+        vertex_count += chunk.verts.size();
+
+        for (size_t i = 0; i + 2 < chunk.elements.size(); i += 3) {
+            faces.writeU8(3);
+            faces.writeU32(chunk.elements[i]);
+            faces.writeU32(chunk.elements[i + 1]);
+            faces.writeU32(chunk.elements[i + 2]);
+        }
+        face_count += chunk.elements.size() / 3;
+    }
+
+    void PlyWriter::finish() {
+        string side = faces.path();
+        faces.close();
+
+        FILE* in = fopen(side.c_str(), "rb");
+        if (!in) {
+            throw runtime_error("Cannot read " + side);
+        }
+        vector<char> block(WRITE_BUFFER_BYTES);
+        size_t n;
+        while ((n = fread(block.data(), 1, block.size(), in)) > 0) {
+            out.write(block.data(), n);
+        }
+        bool failed = ferror(in) != 0;
+        fclose(in);
+        remove(side.c_str());
+        if (failed) {
+            throw runtime_error("Cannot read " + side);
+        }
+
+        string vertices = padded_count(vertex_count);
+        string triangles = padded_count(face_count);
+        out.patch(vertex_count_offset, vertices.data(), vertices.size());
+        out.patch(face_count_offset, triangles.data(), triangles.size());
+        out.close();
+    }
+
+    StlWriter::StlWriter(const string& path) :
+        triangle_count(0),
+        previous_first(0)
+    {
+        out.open(path, "wb");
+
+        // Must not start with "solid", which marks text STL
+        char header[STL_HEADER_BYTES] = {0};
+        strncpy(header, "binary STL written by mc_lib", sizeof(header) - 1);
+        out.write(header, sizeof(header));
+        out.writeU32(0);
+    }
+
+    vec3 StlWriter::position(const Mesh& chunk, size_t first_vertex, size_t i) const {
+        if (i >= first_vertex && i - first_vertex < chunk.verts.size()) {
+            return chunk.verts[i - first_vertex];
+        }
+        if (i >= previous_first && i - previous_first < previous.size()) {
+            return previous[i - previous_first];
+        }
+        throw logic_error("Triangle uses a vertex outside its chunk and the one before it");
+    }
+
+    void StlWriter::consume(const Mesh& chunk, size_t first_vertex) {
+        size_t triangles = chunk.elements.size() / 3;
+        if (triangle_count + triangles > UINT32_MAX) {
+            throw overflow_error("Mesh has too many triangles for STL");
+        }
+
+        for (size_t t = 0; t < triangles; t++) {
+            vec3 a = position(chunk, first_vertex, chunk.elements[3 * t]);
+            vec3 b = position(chunk, first_vertex, chunk.elements[3 * t + 1]);
+            vec3 c = position(chunk, first_vertex, chunk.elements[3 * t + 2]);
+            vec3 normal = cross(b - a, c - a);
+            float len = length(normal);
+
+            out.writeVec3(len > 0 ? normal / len : vec3(0));
+            out.writeVec3(a);
+            out.writeVec3(b);
+            out.writeVec3(c);
+            out.writeU16(0);
+        }
+        triangle_count += (uint32_t)triangles;
+
+        previous.assign(chunk.verts.begin(), chunk.verts.end());
+        previous_first = first_vertex;
+    }
+
+    void StlWriter::finish() {
+        uint8_t count[4] = {(uint8_t)triangle_count, (uint8_t)(triangle_count >> 8), (uint8_t)(triangle_count >> 16), (uint8_t)(triangle_count >> 24)};
+        out.patch(STL_HEADER_BYTES, count, sizeof(count));
+        out.close();
+    }
+
+    ObjWriter::ObjWriter(const string& path) {
+        out.open(path, "wb");
+        out.print("# written by mc_lib\n");
+    }
+
+    // Positions and normals with 9 significant digits, enough to read back the same floats
+    void ObjWriter::consume(const Mesh& chunk, size_t) {
+        for (size_t i = 0; i < chunk.verts.size(); i++) {
+            const vec3& v = chunk.verts[i];
+            out.print("v %.9g %.9g %.9g\n", v.x, v.y, v.z);
+        }
+        for (size_t i = 0; i < chunk.norms.size(); i++) {
+            const vec3& n = chunk.norms[i];
+            out.print("vn %.9g %.9g %.9g\n", n.x, n.y, n.z);
+        }
+        // OBJ indices start at 1
+        for (size_t i = 0; i + 2 < chunk.elements.size(); i += 3) {
+            unsigned long long a = chunk.elements[i] + 1ull;
+            unsigned long long b = chunk.elements[i + 1] + 1ull;
+            unsigned long long c = chunk.elements[i + 2] + 1ull;
+            out.print("f %llu//%llu %llu//%llu %llu//%llu\n", a, a, b, b, c, c);
+        }
+    }
+
+    void ObjWriter::finish() {
+        out.close();
+    }
+
+    void write_mesh(const Mesh& mesh, MeshSink& sink) {
+        sink.consume(mesh, 0);
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+#ifndef _MeshWriter_H_
+#define _MeshWriter_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MarchingCubes.h"
+
+namespace mc {
+
+    // Output file written through a large buffer, so the file sees few big writes of
+    // whole blocks. All methods throw runtime_error when the file cannot be written.
+    class BufferedFile {
+    public:
+        BufferedFile();
+        ~BufferedFile();
+
+        void open(const std::string& path, const char* mode);
+        bool isOpen() const;
+        const std::string& path() const;
+
+        void write(const void* data, size_t bytes);
+        // Little endian binary values
+        void writeU8(uint8_t v);
+        void writeU16(uint16_t v);
+        void writeU32(uint32_t v);
+        void writeF32(float v);
+        void writeVec3(glm::vec3 v);
+        // printf style text
+        void print(const char* format, ...);
+
+        void flush();
+        // Overwrites bytes at offset, which must be within the first 2 GiB
+        void patch(uint64_t offset, const void* data, size_t bytes);
+        // Writes the rest of the buffer and closes the file
+        void close();
+        // Closes the file without writing the rest of the buffer
+        void discard();
+
+    private:
+        std::FILE* file;
+        std::string file_path;
+        std::vector<char> buffer;
+        size_t used;
+
+        BufferedFile(const BufferedFile&);
+        BufferedFile& operator=(const BufferedFile&);
+    };
+
+    // Writes a mesh to a file as a streaming extraction produces it, holding at most the
+    // last two chunks rather than the mesh. finish must be called once the extraction
+    // returns to complete the file, a writer destroyed before that leaves it incomplete.
+    class MeshWriter : public MeshSink {
+    public:
+        virtual ~MeshWriter();
+
+        // Completes and closes the file
+        virtual void finish() = 0;
+    };
+
+    // Binary little endian PLY with positions, normals and triangles. PLY puts all the
+    // vertices before the faces, so faces go to a side file next to path, appended when
+    // the writer finishes, and the counts in the header are patched then.
+    class PlyWriter : public MeshWriter {
+    public:
+        // Creates path, throws runtime_error if it or the side file cannot be created
+        explicit PlyWriter(const std::string& path);
+        ~PlyWriter();
+
+        void consume(const Mesh& chunk, size_t first_vertex);
+        void finish();
+
+    private:
+        BufferedFile out;
+        BufferedFile faces;
+        uint64_t vertex_count;
+        uint64_t face_count;
+        // Offsets of the padded counts in the header
+        uint64_t vertex_count_offset;
+        uint64_t face_count_offset;
+    };
+
+    // Binary STL, one record per triangle with its own copy of the corner positions and a
+    // facet normal from its winding. The triangle count is patched when the writer finishes.
+    class StlWriter : public MeshWriter {
+    public:
+        // Creates path, throws runtime_error if it cannot be created
+        explicit StlWriter(const std::string& path);
+
+        void consume(const Mesh& chunk, size_t first_vertex);
+        void finish();
+
+    private:
+        BufferedFile out;
+        uint32_t triangle_count;
+        // Positions of the previous chunk, which triangles of the next one may use
+        std::vector<glm::vec3> previous;
+        size_t previous_first;
+
+        glm::vec3 position(const Mesh& chunk, size_t first_vertex, size_t i) const;
+    };
+
+    // Wavefront OBJ text with positions, normals and triangles. Every chunk's vertices are
+    // written before its faces, which only use vertices already written.
+    class ObjWriter : public MeshWriter {
+    public:
+        // Creates path, throws runtime_error if it cannot be created
+        explicit ObjWriter(const std::string& path);
+
+        void consume(const Mesh& chunk, size_t first_vertex);
+        void finish();
+
+    private:
+        BufferedFile out;
+    };
+
+    // Passes a whole mesh to sink as a single chunk, to write the output of Extractor
+    void write_mesh(const Mesh& mesh, MeshSink& sink);
+}
+
+#endif /* _MeshWriter_H_ */
@@ -0,0 +1,216 @@
+#include "RawVolume.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Slices past the current one the system is asked to read ahead
+#define READAHEAD_SLICES 4
+// Slices before the current one that are kept. A StreamingExtractor samples slice z
+// while it extracts cell slice z - 3, whose normals read slices z - 4 to z - 1.
+#define RETAINED_SLICES 4
+
+using namespace std;
+
+namespace mc {
+
+    static bool host_big_endian() {
+        uint16_t one = 1;
+        uint8_t first;
+        memcpy(&first, &one, 1);
+        return first == 0;
+    }
+
+    // Converts count voxels of type T at src to float, reversing their bytes if swap is set
+    template <typename T>
+    static void convert(const uint8_t* src, int count, bool swap, float* values) {
+        T v;
+        if (!swap) {
+            for (int i = 0; i < count; i++) {
+                memcpy(&v, src + i * sizeof(T), sizeof(T));
+                values[i] = (float)v;
+            }
+            return;
+        }
+
+        uint8_t bytes[sizeof(T)];
+        for (int i = 0; i < count; i++) {
+            memcpy(bytes, src + i * sizeof(T), sizeof(T));
+            reverse(bytes, bytes + sizeof(T));
+            memcpy(&v, bytes, sizeof(T));
+            values[i] = (float)v;
+        }
+    }
+
+    RawVolume::RawVolume(const string& path, const Grid& grid, VoxelType type, bool big_endian, size_t header_bytes) :
+        VoxelField(grid),
+        type(type),
+        voxel_size(voxel_bytes(type)),
+        swap_bytes(big_endian != host_big_endian()),
+        voxels(NULL),
+        mapping(NULL),
+        mapping_bytes(0)
+    {
+        size_t needed = header_bytes + grid.samples() * voxel_size;
+
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        page_bytes = info.dwPageSize;
+
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw runtime_error("Cannot open volume " + path);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || (unsigned long long)size.QuadPart < needed) {
+            CloseHandle(file);
+            throw runtime_error("Volume " + path + " is smaller than its grid");
+        }
+        file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        void* view = file_mapping ? MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (!view) {
+            if (file_mapping) {
+                CloseHandle(file_mapping);
+            }
+            CloseHandle(file);
+            throw runtime_error("Cannot map volume " + path);
+        }
+        mapping = (const uint8_t*)view;
+        mapping_bytes = (size_t)size.QuadPart;
+#else
+        page_bytes = (size_t)sysconf(_SC_PAGESIZE);
+
+        file = open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            throw runtime_error("Cannot open volume " + path);
+        }
+        struct stat st;
+        if (fstat(file, &st) != 0 || (size_t)st.st_size < needed) {
+            close(file);
+            throw runtime_error("Volume " + path + " is smaller than its grid");
+        }
+        void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, file, 0);
+        if (view == MAP_FAILED) {
+            close(file);
+            throw runtime_error("Cannot map volume " + path);
+        }
+        mapping = (const uint8_t*)view;
+        mapping_bytes = (size_t)st.st_size;
+#endif
+        voxels = mapping + header_bytes;
+    }
+
+    RawVolume::~RawVolume() {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+        CloseHandle(file_mapping);
+        CloseHandle(file);
+#else
+        munmap((void*)mapping, mapping_bytes);
+        close(file);
+#endif
+    }
+
+    size_t RawVolume::voxelOffset(int x, int y, int z) const {
+        return (((size_t)z * volume.ny + y) * volume.nx + x) * voxel_size;
+    }
+
+    void RawVolume::convertRow(size_t offset, int count, float* values) const {
+        const uint8_t* src = voxels + offset;
+        switch (type) {
+        case VOXEL_UINT8:
+            convert<uint8_t>(src, count, false, values);
+            break;
+        case VOXEL_INT8:
+            convert<int8_t>(src, count, false, values);
+            break;
+        case VOXEL_UINT16:
+            convert<uint16_t>(src, count, swap_bytes, values);
+            break;
+        case VOXEL_INT16:
+            convert<int16_t>(src, count, swap_bytes, values);
+            break;
+        case VOXEL_FLOAT32:
+            convert<float>(src, count, swap_bytes, values);
+            break;
+        }
+    }
+
+    float RawVolume::voxel(int x, int y, int z) const {
+        float v = 0;
+        convertRow(voxelOffset(x, y, z), 1, &v);
+        return v;
+    }
+
+    void RawVolume::voxelRow(int x, int y, int z, int count, float* values) const {
+        convertRow(voxelOffset(x, y, z), count, values);
+    }
+
+    void RawVolume::valueRow(float x, float y, float z, float dx, int count, float* values) const {
+        int xi, yi, zi;
+        if (!rowVoxels(x, y, z, dx, count, xi, yi, zi)) {
+            Field::valueRow(x, y, z, dx, count, values);
+            return;
+        }
+
+        if (yi == 0) {
+            sweepTo(zi);
+        }
+        convertRow(voxelOffset(xi, yi, zi), count, values);
+    }
+
+    void RawVolume::sweepTo(int z) const {
+        adviseSlices(z + 1, z + 1 + READAHEAD_SLICES, true);
+        if (z > RETAINED_SLICES) {
+            adviseSlices(z - RETAINED_SLICES - 1, z - RETAINED_SLICES, false);
+        }
+    }
+
+    // Hints that slices [z_begin, z_end) are needed soon, or not any more. Released ranges
+    // end at the page holding the start of z_end, so the ranges of consecutive slices
+    // leave no page behind and never drop one that slice z_end still uses.
+    void RawVolume::adviseSlices(int z_begin, int z_end, bool needed) const {
+        z_begin = std::max(0, std::min(z_begin, volume.nz));
+        z_end = std::max(0, std::min(z_end, volume.nz));
+        size_t begin = (size_t)(voxels - mapping) + voxelOffset(0, 0, z_begin);
+        size_t end = (size_t)(voxels - mapping) + voxelOffset(0, 0, z_end);
+        begin -= begin % page_bytes;
+        if (needed) {
+            end = std::min(end + (page_bytes - end % page_bytes) % page_bytes, mapping_bytes);
+        }
+        else {
+            end -= end % page_bytes;
+        }
+        if (begin >= end) {
+            return;
+        }
+
+        void* address = (void*)(mapping + begin);
+        size_t length = end - begin;
+#ifdef _WIN32
+        if (needed) {
+            WIN32_MEMORY_RANGE_ENTRY range;
+            range.VirtualAddress = address;
+            range.NumberOfBytes = length;
+            PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+        }
+        else {
+            // Unlocking pages that are not locked still removes them from the working set
+            VirtualUnlock(address, length);
+        }
+#else
+        madvise(address, length, needed ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef _RawVolume_H_
+#define _RawVolume_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "VoxelField.h"
+
+namespace mc {
+
+    // Headerless volume file of grid.nx * grid.ny * grid.nz voxels, x fastest then y then z,
+    // mapped into memory instead of read, so volumes larger than RAM can be meshed. Rows
+    // that fall on the voxels, which is every row an extraction over grid() samples, are
+    // converted straight from the mapping.
+    //
+    // Sampling row 0 of slice z hints the system to read the next few slices ahead and
+    // drops the pages of the slices far enough behind z that a StreamingExtractor
+    // sweeping grid() no longer reads them for gradients, so it keeps only a window of
+    // the file resident. Extractors that sample slices out of order still get the right
+    // values, the dropped pages are just read again.
+    class RawVolume : public VoxelField {
+    public:
+        // Maps the file at path, skipping header_bytes at its start. Throws runtime_error
+        // if the file cannot be mapped or is too small, invalid_argument for a bad grid.
+        RawVolume(const std::string& path, const Grid& grid, VoxelType type, bool big_endian = false, size_t header_bytes = 0);
+        ~RawVolume();
+
+        float voxel(int x, int y, int z) const;
+        void valueRow(float x, float y, float z, float dx, int count, float* values) const;
+
+    protected:
+        void voxelRow(int x, int y, int z, int count, float* values) const;
+
+    private:
+        VoxelType type;
+        int voxel_size;
+        // Bytes need swapping on this machine
+        bool swap_bytes;
+
+        const uint8_t* voxels;
+        // Whole mapping, from the start of the file
+        const uint8_t* mapping;
+        size_t mapping_bytes;
+#ifdef _WIN32
+        void* file;
+        void* file_mapping;
+#else
+        int file;
+#endif
+        size_t page_bytes;
+
+        RawVolume(const RawVolume&);
+        RawVolume& operator=(const RawVolume&);
+
+        size_t voxelOffset(int x, int y, int z) const;
+        void convertRow(size_t offset, int count, float* values) const;
+        // Readahead and release hints for a sweep that reached slice z
+        void sweepTo(int z) const;
+        void adviseSlices(int z_begin, int z_end, bool needed) const;
+    };
+}
+
+#endif /* _RawVolume_H_ */
@@ -0,0 +1,148 @@
+#pragma once
+#ifndef _SimdMath_H_
+#define _SimdMath_H_
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MC_SIMD
+#endif
+
+namespace mc {
+
+    // Math that reads the same for float and for four SSE lanes, so a field written once as
+    // a template over its number type can be evaluated either a point or four points at a time
+    namespace simd {
+
+        inline float sqrt(float v) {
+            return std::sqrt(v);
+        }
+
+        inline float abs(float v) {
+            return std::abs(v);
+        }
+
+        inline float min(float a, float b) {
+            return std::min(a, b);
+        }
+
+        inline float max(float a, float b) {
+            return std::max(a, b);
+        }
+
+        inline float cos(float v) {
+            return std::cos(v);
+        }
+
+        inline float sin(float v) {
+            return std::sin(v);
+        }
+
+#ifdef MC_SIMD
+        // Lanes evaluated together
+        const int LANES = 4;
+
+        struct Float4 {
+            __m128 v;
+
+            Float4() {}
+            Float4(__m128 v) : v(v) {}
+            Float4(float s) : v(_mm_set1_ps(s)) {}
+
+            static Float4 load(const float* p) {
+                return _mm_loadu_ps(p);
+            }
+
+            void store(float* p) const {
+                _mm_storeu_ps(p, v);
+            }
+        };
+
+        inline Float4 operator+(Float4 a, Float4 b) {
+            return _mm_add_ps(a.v, b.v);
+        }
+
+        inline Float4 operator-(Float4 a, Float4 b) {
+            return _mm_sub_ps(a.v, b.v);
+        }
+
+        inline Float4 operator*(Float4 a, Float4 b) {
+            return _mm_mul_ps(a.v, b.v);
+        }
+
+        inline Float4 operator/(Float4 a, Float4 b) {
+            return _mm_div_ps(a.v, b.v);
+        }
+
+        inline Float4 operator-(Float4 a) {
+            return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f));
+        }
+
+        inline Float4 sqrt(Float4 a) {
+            return _mm_sqrt_ps(a.v);
+        }
+
+        inline Float4 abs(Float4 a) {
+            return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+        }
+
+        inline Float4 min(Float4 a, Float4 b) {
+            return _mm_min_ps(a.v, b.v);
+        }
+
+        inline Float4 max(Float4 a, Float4 b) {
+            return _mm_max_ps(a.v, b.v);
+        }
+
+        // cos(|a| + turns pi/2). Reduces |a| to r in [-pi/4, pi/4] around the nearest
+        // multiple j of pi/2, with pi/2 split in three parts so large arguments keep their
+        // precision, then picks +-cos(r) or +-sin(r) from the quadrant j + turns. Polynomials
+        // are the Cephes single precision ones, within a few ulps of std::cos over the ranges
+        // fields use.
+        inline Float4 cos_turned(Float4 a, int turns) {
+            __m128 x = abs(a).v;
+            __m128i j = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134f)));
+            __m128 fj = _mm_cvtepi32_ps(j);
+
+            __m128 r = _mm_sub_ps(x, _mm_mul_ps(fj, _mm_set1_ps(1.5703125f)));
+            r = _mm_sub_ps(r, _mm_mul_ps(fj, _mm_set1_ps(4.837512969970703125e-4f)));
+            r = _mm_sub_ps(r, _mm_mul_ps(fj, _mm_set1_ps(7.54978995489188216e-8f)));
+            __m128 r2 = _mm_mul_ps(r, r);
+
+            __m128 c = _mm_set1_ps(2.443315711809948e-5f);
+            c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(-1.388731625493765e-3f));
+            c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.166664568298827e-2f));
+            c = _mm_mul_ps(_mm_mul_ps(c, r2), r2);
+            c = _mm_add_ps(_mm_sub_ps(c, _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+            __m128 s = _mm_set1_ps(-1.9515295891e-4f);
+            s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(8.3321608736e-3f));
+            s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666654611e-1f));
+            s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+
+            // cos(j pi/2 + r) is cos r, -sin r, -cos r, sin r for j % 4 = 0, 1, 2, 3
+            j = _mm_add_epi32(j, _mm_set1_epi32(turns));
+            __m128 use_sin = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+            __m128 negate = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+            __m128 y = _mm_or_ps(_mm_and_ps(use_sin, s), _mm_andnot_ps(use_sin, c));
+            return _mm_xor_ps(y, negate);
+        }
+
+        inline Float4 cos(Float4 a) {
+            return cos_turned(a, 0);
+        }
+
+        // sin |a| is cos(|a| - pi/2), turned by the quadrant rather than by subtracting
+        // pi/2 from a, which would lose the precision of small arguments. sin is odd, so
+        // the result takes the sign of a.
+        inline Float4 sin(Float4 a) {
+            __m128 sign = _mm_and_ps(a.v, _mm_set1_ps(-0.0f));
+            return _mm_xor_ps(cos_turned(a, -1).v, sign);
+        }
+#endif
+    }
+}
+
+#endif /* _SimdMath_H_ */
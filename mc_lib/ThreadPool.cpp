@@ -0,0 +1,110 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace mc {
+
+    ThreadPool::ThreadPool(int threads) :
+        stopping(false)
+    {
+        if (threads <= 0) {
+            threads = max(1, (int)thread::hardware_concurrency());
+        }
+        for (int i = 1; i < threads; i++) {
+            workers.push_back(thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            unique_lock<mutex> held(lock);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    int ThreadPool::size() const {
+        return (int)workers.size() + 1;
+    }
+
+    void ThreadPool::runOne(Batch* batch, unique_lock<mutex>& held) {
+        int i = batch->next++;
+        if (batch->next == batch->count) {
+            // Fully claimed, no other thread needs to see it
+            batches.erase(find(batches.begin(), batches.end(), batch));
+        }
+        held.unlock();
+
+        exception_ptr error;
+        try {
+            (*batch->task)(i);
+        }
+        catch (...) {
+            error = current_exception();
+        }
+
+        held.lock();
+        if (error && !batch->error) {
+            batch->error = error;
+        }
+        if (--batch->remaining == 0) {
+            batch_done.notify_all();
+        }
+    }
+
+    void ThreadPool::workerLoop() {
+        unique_lock<mutex> held(lock);
+        while (true) {
+            while (!stopping && batches.empty()) {
+                work_ready.wait(held);
+            }
+            if (stopping) {
+                return;
+            }
+            runOne(batches.front(), held);
+        }
+    }
+
+    void ThreadPool::run(int count, const function<void(int)>& task) {
+        if (count <= 0) {
+            return;
+        }
+
+        Batch batch;
+        batch.task = &task;
+        batch.next = 0;
+        batch.count = count;
+        batch.remaining = count;
+
+        unique_lock<mutex> held(lock);
+        batches.push_back(&batch);
+        work_ready.notify_all();
+
+        while (batch.next < batch.count) {
+            runOne(&batch, held);
+        }
+        while (batch.remaining > 0) {
+            batch_done.wait(held);
+        }
+        held.unlock();
+
+        if (batch.error) {
+            rethrow_exception(batch.error);
+        }
+    }
+
+    void parallel_for(ThreadPool* pool, int count, const function<void(int)>& task) {
+        if (pool) {
+            pool->run(count, task);
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            task(i);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef _ThreadPool_H_
+#define _ThreadPool_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mc {
+
+    // Persistent set of worker threads for data-parallel loops. Several threads may
+    // call run() at once; the caller always helps with its own batch, so nested or
+    // concurrent runs never wait on an idle pool.
+    class ThreadPool {
+    public:
+        // threads is the total parallelism including the calling thread, 0 picks one per core
+        ThreadPool(int threads = 0);
+        ~ThreadPool();
+
+        // Number of threads that work on a batch, including the caller
+        int size() const;
+
+        // Calls task(i) for every i in [0, count) and returns once all calls have finished.
+        // The first exception thrown by a task is rethrown here.
+        void run(int count, const std::function<void(int)>& task);
+
+    private:
+        struct Batch {
+            const std::function<void(int)>* task;
+            int next;
+            int count;
+            int remaining;
+            std::exception_ptr error;
+        };
+
+        std::vector<std::thread> workers;
+        std::deque<Batch*> batches;
+        std::mutex lock;
+        std::condition_variable work_ready;
+        std::condition_variable batch_done;
+        bool stopping;
+
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+
+        void workerLoop();
+        // Claims and runs one index of batch; lock must be held and is held again on return
+        void runOne(Batch* batch, std::unique_lock<std::mutex>& held);
+    };
+
+    // Runs task(0..count-1) on pool, or serially on the calling thread when pool is NULL
+    void parallel_for(ThreadPool* pool, int count, const std::function<void(int)>& task);
+}
+
+#endif /* _ThreadPool_H_ */
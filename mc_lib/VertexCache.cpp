@@ -0,0 +1,182 @@
+#include "VertexCache.h"
+
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+namespace mc {
+
+    static float vertex_score(int cache_pos, int active_tris) {
+        if (active_tris == 0) {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cache_pos >= 0) {
+            if (cache_pos < 3) {
+                // The last triangle's vertices get a fixed score so they aren't reused immediately
+                score = LAST_TRI_SCORE;
+            }
+            else {
+                float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+                score = pow(1.0f - (cache_pos - 3) * scaler, CACHE_DECAY_POWER);
+            }
+        }
+
+        // Favor vertices with few triangles left so that they get finished off
+        score += VALENCE_BOOST_SCALE * pow((float)active_tris, -VALENCE_BOOST_POWER);
+        return score;
+    }
+
+    static void reorder_triangles(vector<unsigned int>& elements, size_t vertex_count) {
+        size_t tri_count = elements.size() / 3;
+
+        // Triangle adjacency for every vertex, packed into one array
+        vector<unsigned int> tri_offset(vertex_count + 1, 0);
+        for (size_t i = 0; i < elements.size(); i++) {
+            tri_offset[elements[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertex_count; v++) {
+            tri_offset[v + 1] += tri_offset[v];
+        }
+
+        vector<int> active_tris(vertex_count, 0);
+        vector<unsigned int> adjacency(elements.size());
+        for (size_t t = 0; t < tri_count; t++) {
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = elements[t * 3 + k];
+                adjacency[tri_offset[v] + active_tris[v]++] = t;
+            }
+        }
+
+        vector<int> cache_pos(vertex_count, -1);
+        vector<float> vert_score(vertex_count);
+        for (size_t v = 0; v < vertex_count; v++) {
+            vert_score[v] = vertex_score(-1, active_tris[v]);
+        }
+
+        vector<bool> emitted(tri_count, false);
+        vector<float> tri_score(tri_count);
+        for (size_t t = 0; t < tri_count; t++) {
+            tri_score[t] = vert_score[elements[t * 3]] + vert_score[elements[t * 3 + 1]] + vert_score[elements[t * 3 + 2]];
+        }
+
+        vector<unsigned int> cache;
+        vector<unsigned int> next_cache;
+        vector<unsigned int> reordered;
+        reordered.reserve(elements.size());
+
+        size_t cursor = 0;
+        long long best_tri = -1;
+        for (size_t i = 0; i < tri_count; i++) {
+            if (best_tri < 0) {
+                // Nothing in the cache touches a pending triangle, restart from the first one
+                while (emitted[cursor]) {
+                    cursor++;
+                }
+                best_tri = cursor;
+            }
+
+            unsigned int* tri = &elements[best_tri * 3];
+            emitted[best_tri] = true;
+            reordered.push_back(tri[0]);
+            reordered.push_back(tri[1]);
+            reordered.push_back(tri[2]);
+
+            // Drop the triangle from the adjacency of its vertices
+            for (int k = 0; k < 3; k++) {
+                unsigned int v = tri[k];
+                unsigned int* adj = &adjacency[tri_offset[v]];
+                for (int j = 0; j < active_tris[v]; j++) {
+                    if (adj[j] == best_tri) {
+                        adj[j] = adj[active_tris[v] - 1];
+                        break;
+                    }
+                }
+                active_tris[v]--;
+            }
+
+            // Move the triangle's vertices to the front of the simulated LRU cache
+            next_cache.assign(tri, tri + 3);
+            for (size_t j = 0; j < cache.size(); j++) {
+                unsigned int v = cache[j];
+                if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                    next_cache.push_back(v);
+                }
+            }
+            cache.swap(next_cache);
+
+            for (size_t j = 0; j < cache.size(); j++) {
+                unsigned int v = cache[j];
+                cache_pos[v] = j < VERTEX_CACHE_SIZE ? (int)j : -1;
+                vert_score[v] = vertex_score(cache_pos[v], active_tris[v]);
+            }
+
+            // Rescore the pending triangles around the cache and pick the best one
+            best_tri = -1;
+            float best_score = -1.0f;
+            for (size_t j = 0; j < cache.size(); j++) {
+                unsigned int v = cache[j];
+                unsigned int* adj = &adjacency[tri_offset[v]];
+                for (int a = 0; a < active_tris[v]; a++) {
+                    unsigned int t = adj[a];
+                    tri_score[t] = vert_score[elements[t * 3]] + vert_score[elements[t * 3 + 1]] + vert_score[elements[t * 3 + 2]];
+                    if (tri_score[t] > best_score) {
+                        best_score = tri_score[t];
+                        best_tri = t;
+                    }
+                }
+            }
+
+            if (cache.size() > VERTEX_CACHE_SIZE) {
+                cache.resize(VERTEX_CACHE_SIZE);
+            }
+        }
+
+        elements.swap(reordered);
+    }
+
+    static void reorder_vertices(Mesh& mesh) {
+        const unsigned int unused = (unsigned int)-1;
+        vector<unsigned int> remap(mesh.verts.size(), unused);
+        vector<vec3> verts(mesh.verts.size());
+        vector<vec3> norms(mesh.norms.size());
+
+        unsigned int next = 0;
+        for (size_t i = 0; i < mesh.elements.size(); i++) {
+            unsigned int v = mesh.elements[i];
+            if (remap[v] == unused) {
+                remap[v] = next;
+                verts[next] = mesh.verts[v];
+                norms[next] = mesh.norms[v];
+                next++;
+            }
+            mesh.elements[i] = remap[v];
+        }
+
+        // Unreferenced vertices go at the end
+        for (size_t v = 0; v < remap.size(); v++) {
+            if (remap[v] == unused) {
+                verts[next] = mesh.verts[v];
+                norms[next] = mesh.norms[v];
+                next++;
+            }
+        }
+
+        mesh.verts.swap(verts);
+        mesh.norms.swap(norms);
+    }
+
+    void optimize_vertex_cache(Mesh& mesh) {
+        reorder_triangles(mesh.elements, mesh.verts.size());
+        reorder_vertices(mesh);
+        // The buffers no longer match the extraction that wrote them
+        mesh.generation = 0;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#ifndef _VertexCache_H_
+#define _VertexCache_H_
+
+#include "MarchingCubes.h"
+
+namespace mc {
+
+    // Number of entries in the post-transform vertex cache the ordering is tuned for
+    const int VERTEX_CACHE_SIZE = 32;
+
+    // Reorders the triangles of mesh for post-transform vertex cache reuse (Forsyth's
+    // linear-speed algorithm), then renumbers vertices in first-use order so that
+    // vertex fetches stream through memory. Geometry and winding are unchanged, the
+    // generation is reset so a later update extracts afresh.
+    void optimize_vertex_cache(Mesh& mesh);
+}
+
+#endif /* _VertexCache_H_ */
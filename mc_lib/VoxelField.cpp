@@ -0,0 +1,156 @@
+#include "VoxelField.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+// How far a coordinate may be from a voxel and still count as on it, in voxels
+#define LATTICE_TOLERANCE 1e-3f
+
+using namespace glm;
+using namespace std;
+
+namespace mc {
+
+    int voxel_bytes(VoxelType type) {
+        switch (type) {
+        case VOXEL_UINT8:
+        case VOXEL_INT8:
+            return 1;
+        case VOXEL_UINT16:
+        case VOXEL_INT16:
+            return 2;
+        case VOXEL_FLOAT32:
+            return 4;
+        }
+        throw invalid_argument("Unknown voxel type");
+    }
+
+    // Index of the voxel at coordinate c along one axis, or -1 if c is not on one
+    static int lattice_index(float c, float origin, float spacing, int n) {
+        float f = (c - origin) / spacing;
+        float r = floor(f + .5f);
+        if (abs(f - r) > LATTICE_TOLERANCE || r < 0 || r >= n) {
+            return -1;
+        }
+        return (int)r;
+    }
+
+    VoxelField::VoxelField(const Grid& grid) :
+        volume(grid)
+    {
+        if (grid.nx < 2 || grid.ny < 2 || grid.nz < 2) {
+            throw invalid_argument("Grid needs at least 2 samples along each axis");
+        }
+        if (grid.spacing.x <= 0 || grid.spacing.y <= 0 || grid.spacing.z <= 0) {
+            throw invalid_argument("Grid spacing must be positive");
+        }
+    }
+
+    const Grid& VoxelField::grid() const {
+        return volume;
+    }
+
+    float VoxelField::value(float x, float y, float z) const {
+        // Cell holding the point and the position inside it, clamped to the volume. The
+        // far corner along an axis stands in for the near one where its weight is zero, so
+        // a point on a face or a lattice point reads no voxel past it.
+        vec3 f = (vec3(x, y, z) - volume.origin) / volume.spacing;
+        int n[3] = {volume.nx, volume.ny, volume.nz};
+        int i[3], j[3];
+        float t[3];
+        for (int a = 0; a < 3; a++) {
+            float c = std::min(std::max(f[a], 0.0f), (float)(n[a] - 1));
+            i[a] = std::min((int)c, n[a] - 2);
+            t[a] = c - i[a];
+            j[a] = t[a] > 0 ? i[a] + 1 : i[a];
+        }
+
+        float c00 = mix(voxel(i[0], i[1], i[2]), voxel(j[0], i[1], i[2]), t[0]);
+        float c10 = mix(voxel(i[0], j[1], i[2]), voxel(j[0], j[1], i[2]), t[0]);
+        float c01 = mix(voxel(i[0], i[1], j[2]), voxel(j[0], i[1], j[2]), t[0]);
+        float c11 = mix(voxel(i[0], j[1], j[2]), voxel(j[0], j[1], j[2]), t[0]);
+        return mix(mix(c00, c10, t[1]), mix(c01, c11, t[1]), t[2]);
+    }
+
+    vec3 VoxelField::gradient(float x, float y, float z, vec3 h) const {
+        int xi = lattice_index(x, volume.origin.x, volume.spacing.x, volume.nx);
+        int yi = lattice_index(y, volume.origin.y, volume.spacing.y, volume.ny);
+        int zi = lattice_index(z, volume.origin.z, volume.spacing.z, volume.nz);
+        if (xi < 0 || yi < 0 || zi < 0 || !latticeSpacing(h)) {
+            return Field::gradient(x, y, z, h);
+        }
+        return latticeGradient(xi, yi, zi);
+    }
+
+    // Reads the row with the voxel either side of it and the four rows around it, so
+    // each voxel of the stencils is read once
+    void VoxelField::gradientRow(float x, float y, float z, float dx, int count, vec3 h, vec3* gradients) const {
+        int xi, yi, zi;
+        if (!rowVoxels(x, y, z, dx, count, xi, yi, zi) || !latticeSpacing(h)) {
+            Field::gradientRow(x, y, z, dx, count, h, gradients);
+            return;
+        }
+
+        int begin = std::max(xi - 1, 0);
+        int end = std::min(xi + count, volume.nx - 1);
+        vector<float> rows(end - begin + 1 + 4 * count);
+        float* row = rows.data();
+        float* y_lo = row + (end - begin + 1);
+        float* y_hi = y_lo + count;
+        float* z_lo = y_hi + count;
+        float* z_hi = z_lo + count;
+        voxelRow(begin, yi, zi, end - begin + 1, row);
+        voxelRow(xi, std::max(yi - 1, 0), zi, count, y_lo);
+        voxelRow(xi, std::min(yi + 1, volume.ny - 1), zi, count, y_hi);
+        voxelRow(xi, yi, std::max(zi - 1, 0), count, z_lo);
+        voxelRow(xi, yi, std::min(zi + 1, volume.nz - 1), count, z_hi);
+
+        vec3 scale = .5f / volume.spacing;
+        for (int i = 0; i < count; i++) {
+            int lo = std::max(xi + i - 1, 0) - begin;
+            int hi = std::min(xi + i + 1, volume.nx - 1) - begin;
+            gradients[i] = vec3(row[hi] - row[lo], y_hi[i] - y_lo[i], z_hi[i] - z_lo[i]) * scale;
+        }
+    }
+
+    void VoxelField::voxelRow(int x, int y, int z, int count, float* values) const {
+        for (int i = 0; i < count; i++) {
+            values[i] = voxel(x + i, y, z);
+        }
+    }
+
+    vec3 VoxelField::latticeGradient(int x, int y, int z) const {
+        float xl = voxel(std::max(x - 1, 0), y, z);
+        float xg = voxel(std::min(x + 1, volume.nx - 1), y, z);
+        float yl = voxel(x, std::max(y - 1, 0), z);
+        float yg = voxel(x, std::min(y + 1, volume.ny - 1), z);
+        float zl = voxel(x, y, std::max(z - 1, 0));
+        float zg = voxel(x, y, std::min(z + 1, volume.nz - 1));
+        return vec3(xg - xl, yg - yl, zg - zl) * (.5f / volume.spacing);
+    }
+
+    bool VoxelField::rowVoxels(float x, float y, float z, float dx, int count, int& xi, int& yi, int& zi) const {
+        xi = lattice_index(x, volume.origin.x, volume.spacing.x, volume.nx);
+        yi = lattice_index(y, volume.origin.y, volume.spacing.y, volume.ny);
+        zi = lattice_index(z, volume.origin.z, volume.spacing.z, volume.nz);
+        return xi >= 0 && yi >= 0 && zi >= 0 && xi + count <= volume.nx &&
+            abs(dx / volume.spacing.x - 1) < LATTICE_TOLERANCE / volume.nx;
+    }
+
+    bool VoxelField::latticeSpacing(vec3 h) const {
+        vec3 r = h / volume.spacing - 1.0f;
+        return abs(r.x) < LATTICE_TOLERANCE && abs(r.y) < LATTICE_TOLERANCE && abs(r.z) < LATTICE_TOLERANCE;
+    }
+
+    void VoxelField::boxVoxels(vec3 lo, vec3 hi, int* begin, int* end) const {
+        vec3 f_lo = (lo - volume.origin) / volume.spacing;
+        vec3 f_hi = (hi - volume.origin) / volume.spacing;
+        int n[3] = {volume.nx, volume.ny, volume.nz};
+        for (int a = 0; a < 3; a++) {
+            begin[a] = (int)std::min(std::max(floor(f_lo[a] + LATTICE_TOLERANCE), 0.0f), (float)(n[a] - 1));
+            end[a] = (int)std::min(std::max(ceil(f_hi[a] - LATTICE_TOLERANCE), 0.0f), (float)(n[a] - 1));
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef _VoxelField_H_
+#define _VoxelField_H_
+
+#include "Field.h"
+#include "MarchingCubes.h"
+
+namespace mc {
+
+    // Storage of each voxel in a volume file. Bricked volume files store the value, so
+    // new types go at the end.
+    enum VoxelType {
+        VOXEL_UINT8,
+        VOXEL_UINT16,
+        VOXEL_INT16,
+        VOXEL_FLOAT32,
+        VOXEL_INT8
+    };
+
+    // Bytes per voxel of type
+    int voxel_bytes(VoxelType type);
+
+    // Field given by voxels on a grid. Voxel (x, y, z) is the sample at
+    // grid.position(x, y, z), values between voxels are interpolated trilinearly and
+    // points outside the grid take the value of the nearest voxel. At voxels, with h the
+    // voxel spacing, gradients are central differences of the neighbouring voxels, the
+    // differences Field takes there, read without interpolating.
+    class VoxelField : public Field {
+    public:
+        // Throws invalid_argument for a grid without cells
+        VoxelField(const Grid& grid);
+
+        // Placement and size of the voxels
+        const Grid& grid() const;
+
+        // Voxel (x, y, z), indices must be inside the grid
+        virtual float voxel(int x, int y, int z) const = 0;
+
+        float value(float x, float y, float z) const;
+        glm::vec3 gradient(float x, float y, float z, glm::vec3 h) const;
+        void gradientRow(float x, float y, float z, float dx, int count, glm::vec3 h, glm::vec3* gradients) const;
+
+    protected:
+        Grid volume;
+
+        // count voxels of row (y, z) from x on, which must be inside the grid. Defaults to
+        // a voxel call per voxel.
+        virtual void voxelRow(int x, int y, int z, int count, float* values) const;
+        // Central differences around voxel (x, y, z), clamped to the grid, divided by the
+        // voxel spacing. Defaults to six voxel calls.
+        virtual glm::vec3 latticeGradient(int x, int y, int z) const;
+
+        // Voxel of the first of count points dx apart along x from (x, y, z), when all
+        // of them are voxels of one row
+        bool rowVoxels(float x, float y, float z, float dx, int count, int& xi, int& yi, int& zi) const;
+        // Whether h is the voxel spacing
+        bool latticeSpacing(glm::vec3 h) const;
+        // Range of voxels from the one at or below lo to the one at or above hi, clamped to the grid
+        void boxVoxels(glm::vec3 lo, glm::vec3 hi, int* begin, int* end) const;
+    };
+}
+
+#endif /* _VoxelField_H_ */